@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+// Number of times the global operator new has been called, so a benchmark can
+// report what a kernel costs the heap
+size_t allocation_count();
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Keep the optimizer from discarding a value that is otherwise unused
+template <typename T> inline void do_not_optimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchmarkResult {
+  std::string m_name;
+  std::string m_unit;
+  // Number of items (rays, samples, ...) processed by one iteration
+  double m_items_per_iteration;
+  size_t m_iterations_per_sample;
+  // Nanoseconds per iteration, one entry per sample
+  std::vector<double> m_sample_ns;
+  // Extra per benchmark figures, such as nodes visited per ray
+  std::vector<std::pair<std::string, double>> m_counters;
+
+  double min_ns() const;
+  double median_ns() const;
+  double mean_ns() const;
+  double stddev_ns() const;
+  double items_per_second() const;
+};
+
+class BenchmarkRunner {
+public:
+  // Runs the batch with the requested number of iterations
+  using t_BatchFunction = std::function<void(size_t)>;
+
+  BenchmarkRunner(const std::chrono::duration<double> min_sample_time,
+                  const size_t num_samples, const std::string &filter)
+      : m_min_sample_time(min_sample_time)
+      , m_num_samples(num_samples)
+      , m_filter(filter) {}
+
+  // Calibrates the iteration count so that every sample runs for at least
+  // the minimum sample time, warms up once, then records each sample.
+  void run(const std::string &name, const std::string &unit,
+           const double items_per_iteration, const t_BatchFunction &batch);
+
+  // Times a single call per sample, for kernels too slow to batch
+  void run_once(const std::string &name, const std::string &unit,
+                const double items_per_iteration,
+                const std::function<void(void)> &setup,
+                const std::function<void(void)> &kernel);
+
+  // Attaches a figure to the most recent benchmark, if it was run
+  void add_counter(const std::string &name, const double value);
+
+  void write_json(std::ostream &out) const;
+
+  const std::vector<BenchmarkResult> &results() const { return m_results; }
+
+private:
+  bool is_selected(const std::string &name) const;
+  void report(const BenchmarkResult &result) const;
+
+  const std::chrono::duration<double> m_min_sample_time;
+  const size_t m_num_samples;
+  const std::string m_filter;
+  std::vector<BenchmarkResult> m_results;
+  bool m_last_selected = false;
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts last level cache misses of this thread and the threads it starts
+// from here on, through perf_event_open. Virtual machines often don't expose
+// the counters, check is_available() before trusting read().
+class CacheMissCounter {
+public:
+  CacheMissCounter();
+  ~CacheMissCounter();
+
+  CacheMissCounter(const CacheMissCounter &) = delete;
+  CacheMissCounter &operator=(const CacheMissCounter &) = delete;
+
+  bool is_available() const { return m_file_descriptor >= 0; }
+
+  void reset();
+  std::uint64_t read() const;
+
+private:
+  int m_file_descriptor = -1;
+};
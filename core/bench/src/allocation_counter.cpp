@@ -0,0 +1,26 @@
+#include <allocation_counter.hpp>
+
+#include <cstdlib>
+#include <new>
+
+// The replacements live in their own file so that GCC can't inline them into
+// callers and then mistake the malloc() and free() for a mismatched pair
+namespace {
+
+size_t num_allocations = 0;
+
+} // namespace
+
+size_t allocation_count() { return num_allocations; }
+
+void *operator new(const size_t size) {
+  ++num_allocations;
+  if (void *pointer = std::malloc(size == 0 ? 1 : size)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, size_t) noexcept { std::free(pointer); }
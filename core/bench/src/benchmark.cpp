@@ -0,0 +1,177 @@
+#include <benchmark.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <thread>
+
+#ifndef RT_GIT_REVISION
+#define RT_GIT_REVISION "unknown"
+#endif
+
+using t_Clock = std::chrono::steady_clock;
+
+double BenchmarkResult::min_ns() const {
+  return *std::min_element(std::begin(m_sample_ns), std::end(m_sample_ns));
+}
+
+double BenchmarkResult::median_ns() const {
+  std::vector<double> sorted(m_sample_ns);
+  std::sort(std::begin(sorted), std::end(sorted));
+  const size_t middle = sorted.size() / 2;
+  if (sorted.size() % 2 == 0) {
+    return 0.5 * (sorted[middle - 1] + sorted[middle]);
+  }
+  return sorted[middle];
+}
+
+double BenchmarkResult::mean_ns() const {
+  return std::accumulate(std::begin(m_sample_ns), std::end(m_sample_ns), 0.0) /
+         m_sample_ns.size();
+}
+
+double BenchmarkResult::stddev_ns() const {
+  if (m_sample_ns.size() < 2) {
+    return 0.0;
+  }
+  const double mean = mean_ns();
+  double sum_squares = 0.0;
+  for (const auto sample : m_sample_ns) {
+    sum_squares += (sample - mean) * (sample - mean);
+  }
+  return std::sqrt(sum_squares / (m_sample_ns.size() - 1));
+}
+
+double BenchmarkResult::items_per_second() const {
+  return m_items_per_iteration * 1e9 / median_ns();
+}
+
+bool BenchmarkRunner::is_selected(const std::string &name) const {
+  return m_filter.empty() || name.find(m_filter) != std::string::npos;
+}
+
+void BenchmarkRunner::run(const std::string &name, const std::string &unit,
+                          const double items_per_iteration,
+                          const t_BatchFunction &batch) {
+  m_last_selected = is_selected(name);
+  if (!m_last_selected) {
+    return;
+  }
+
+  // Grow the batch until a single sample takes long enough to time reliably
+  size_t iterations = 1;
+  for (;;) {
+    const auto start = t_Clock::now();
+    batch(iterations);
+    const std::chrono::duration<double> elapsed = t_Clock::now() - start;
+    if (elapsed >= m_min_sample_time) {
+      break;
+    }
+    const double scale =
+        elapsed.count() > 0 ? m_min_sample_time / elapsed * 1.2 : 10.0;
+    iterations = std::max<size_t>(
+        iterations + 1, size_t(iterations * std::min(scale, 10.0)));
+  }
+
+  BenchmarkResult result{name, unit, items_per_iteration, iterations, {}, {}};
+  result.m_sample_ns.reserve(m_num_samples);
+  for (size_t sample = 0; sample < m_num_samples; ++sample) {
+    const auto start = t_Clock::now();
+    batch(iterations);
+    const std::chrono::duration<double, std::nano> elapsed =
+        t_Clock::now() - start;
+    result.m_sample_ns.push_back(elapsed.count() / iterations);
+  }
+
+  report(result);
+  m_results.push_back(std::move(result));
+}
+
+void BenchmarkRunner::run_once(const std::string &name,
+                               const std::string &unit,
+                               const double items_per_iteration,
+                               const std::function<void(void)> &setup,
+                               const std::function<void(void)> &kernel) {
+  m_last_selected = is_selected(name);
+  if (!m_last_selected) {
+    return;
+  }
+
+  // Warm up caches and the allocator
+  setup();
+  kernel();
+
+  BenchmarkResult result{name, unit, items_per_iteration, 1, {}, {}};
+  result.m_sample_ns.reserve(m_num_samples);
+  for (size_t sample = 0; sample < m_num_samples; ++sample) {
+    setup();
+    const auto start = t_Clock::now();
+    kernel();
+    const std::chrono::duration<double, std::nano> elapsed =
+        t_Clock::now() - start;
+    result.m_sample_ns.push_back(elapsed.count());
+  }
+
+  report(result);
+  m_results.push_back(std::move(result));
+}
+
+void BenchmarkRunner::add_counter(const std::string &name,
+                                  const double value) {
+  if (!m_last_selected) {
+    return;
+  }
+  m_results.back().m_counters.emplace_back(name, value);
+  std::clog << std::left << std::setw(36) << ("  " + name) << std::right
+            << std::fixed << std::setprecision(2) << std::setw(14) << value
+            << std::endl;
+}
+
+void BenchmarkRunner::report(const BenchmarkResult &result) const {
+  std::clog << std::left << std::setw(36) << result.m_name << std::right
+            << std::fixed << std::setprecision(2) << std::setw(14)
+            << result.median_ns() << " ns/iter  +/- " << std::setw(6)
+            << 100.0 * result.stddev_ns() / result.mean_ns() << "%  "
+            << std::setw(12) << result.items_per_second() / 1e6 << " M"
+            << result.m_unit << "/s" << std::endl;
+}
+
+void BenchmarkRunner::write_json(std::ostream &out) const {
+  const auto now = std::time(nullptr);
+  char timestamp[32];
+  std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ",
+                std::gmtime(&now));
+
+  out << std::setprecision(6) << std::defaultfloat;
+  out << "{\n";
+  out << "  \"revision\": \"" << RT_GIT_REVISION << "\",\n";
+  out << "  \"timestamp\": \"" << timestamp << "\",\n";
+  out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+  out << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency()
+      << ",\n";
+  out << "  \"benchmarks\": [";
+  for (size_t index = 0; index < m_results.size(); ++index) {
+    const auto &result = m_results[index];
+    out << (index == 0 ? "\n" : ",\n");
+    out << "    {\n";
+    out << "      \"name\": \"" << result.m_name << "\",\n";
+    out << "      \"unit\": \"" << result.m_unit << "\",\n";
+    out << "      \"iterations_per_sample\": " << result.m_iterations_per_sample
+        << ",\n";
+    out << "      \"samples\": " << result.m_sample_ns.size() << ",\n";
+    out << "      \"min_ns\": " << result.min_ns() << ",\n";
+    out << "      \"median_ns\": " << result.median_ns() << ",\n";
+    out << "      \"mean_ns\": " << result.mean_ns() << ",\n";
+    out << "      \"stddev_ns\": " << result.stddev_ns() << ",\n";
+    out << "      \"items_per_second\": " << result.items_per_second();
+    for (const auto &[counter, value] : result.m_counters) {
+      out << ",\n      \"" << counter << "\": " << value;
+    }
+    out << "\n";
+    out << "    }";
+  }
+  out << "\n  ]\n}\n";
+}
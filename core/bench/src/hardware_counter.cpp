@@ -0,0 +1,43 @@
+#include <hardware_counter.hpp>
+
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+CacheMissCounter::CacheMissCounter() {
+  perf_event_attr attributes;
+  std::memset(&attributes, 0, sizeof(attributes));
+  attributes.size = sizeof(attributes);
+  attributes.type = PERF_TYPE_HARDWARE;
+  attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+  attributes.exclude_kernel = 1;
+  attributes.exclude_hv = 1;
+  // Worker threads started later are counted too
+  attributes.inherit = 1;
+  m_file_descriptor =
+      int(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+}
+
+CacheMissCounter::~CacheMissCounter() {
+  if (m_file_descriptor >= 0) {
+    close(m_file_descriptor);
+  }
+}
+
+void CacheMissCounter::reset() {
+  if (m_file_descriptor >= 0) {
+    ioctl(m_file_descriptor, PERF_EVENT_IOC_RESET, 0);
+  }
+}
+
+std::uint64_t CacheMissCounter::read() const {
+  std::uint64_t count = 0;
+  if (m_file_descriptor >= 0 &&
+      ::read(m_file_descriptor, &count, sizeof(count)) != sizeof(count)) {
+    count = 0;
+  }
+  return count;
+}
@@ -0,0 +1,550 @@
+#include <allocation_counter.hpp>
+#include <benchmark.hpp>
+
+#include <aabb.hpp>
+#include <bvh.hpp>
+#include <camera.hpp>
+#include <color.hpp>
+#include <compressed_bvh.hpp>
+#include <constants.hpp>
+#include <hardware_counter.hpp>
+#include <hittable.hpp>
+#include <material.hpp>
+#include <ray.hpp>
+#include <ray_query.hpp>
+#include <sphere.hpp>
+#include <texture.hpp>
+#include <traversal_stats.hpp>
+#include <vec3.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr unsigned int benchmark_seed = 0x5eed;
+constexpr size_t num_rays = 1 << 14;
+
+// Swallows everything written to it, while still paying for the formatting
+class DiscardBuffer : public std::streambuf {
+public:
+  DiscardBuffer() { setp(m_buffer, m_buffer + sizeof(m_buffer)); }
+
+protected:
+  int overflow(int character) override {
+    setp(m_buffer, m_buffer + sizeof(m_buffer));
+    return character;
+  }
+
+private:
+  char m_buffer[4096];
+};
+
+// Roughly the layout of the "Ray Tracing in One Weekend" final scene
+std::vector<std::shared_ptr<Hittable>> make_sphere_field() {
+  std::vector<std::shared_ptr<Hittable>> objects;
+
+  const auto material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+  objects.push_back(
+      std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, material));
+
+  for (int a = -11; a < 11; ++a) {
+    for (int b = -11; b < 11; ++b) {
+      const Point3 center(a + 0.6 * random_double(), 0.2,
+                          b + 0.6 * random_double());
+      objects.push_back(std::make_shared<Sphere>(center, 0.2, material));
+    }
+  }
+
+  objects.push_back(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material));
+  objects.push_back(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material));
+  objects.push_back(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material));
+
+  return objects;
+}
+
+// Hides a primitive's motion bounds, so a BVH over it falls back to the box
+// around the whole motion like it did before temporal bounds
+class UnionBounds : public Hittable {
+public:
+  explicit UnionBounds(std::shared_ptr<Hittable> object)
+      : m_object(std::move(object)) {}
+
+  bool hit(const Ray &ray, Interval ray_t,
+           HitRecord &hit_record) const override {
+    return m_object->hit(ray, ray_t, hit_record);
+  }
+
+  AxisAlignedBoundingBox bounding_box() const override {
+    return m_object->bounding_box();
+  }
+
+private:
+  std::shared_ptr<Hittable> m_object;
+};
+
+// The sphere field with every small ball moving a long way during the
+// shutter, so the boxes around whole motions overlap heavily
+std::vector<std::shared_ptr<Hittable>> make_moving_sphere_field() {
+  std::vector<std::shared_ptr<Hittable>> objects;
+
+  const auto material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+  objects.push_back(
+      std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, material));
+
+  for (int a = -11; a < 11; ++a) {
+    for (int b = -11; b < 11; ++b) {
+      const Point3 center(a + 0.6 * random_double(), 0.2,
+                          b + 0.6 * random_double());
+      const Vec3 motion(random_double(-2, 2), random_double(0, 1.5),
+                        random_double(-2, 2));
+      objects.push_back(
+          std::make_shared<Sphere>(center, center + motion, 0.2, material));
+    }
+  }
+
+  return objects;
+}
+
+std::vector<Ray> make_random_rays() {
+  std::vector<Ray> rays;
+  rays.reserve(num_rays);
+  for (size_t index = 0; index < num_rays; ++index) {
+    const Point3 origin(random_double(-12, 12), random_double(0.1, 3),
+                        random_double(-12, 12));
+    rays.emplace_back(origin, random_unit_vector(), random_double());
+  }
+  return rays;
+}
+
+// Primary rays of a pinhole camera, in scanline order
+std::vector<Ray> make_coherent_rays() {
+  const Point3 camera_position(13, 2, 3);
+  const auto w = unit_vector(camera_position - Point3(0, 0, 0));
+  const auto u = unit_vector(cross(Vec3(0, 1, 0), w));
+  const auto v = cross(w, u);
+
+  const unsigned int width = 128;
+  const unsigned int height = num_rays / width;
+  const double viewport_height = 2 * std::tan(degrees_to_radians(20) / 2);
+  const double viewport_width = viewport_height * double(width) / height;
+
+  std::vector<Ray> rays;
+  rays.reserve(num_rays);
+  for (unsigned int row = 0; row < height; ++row) {
+    for (unsigned int column = 0; column < width; ++column) {
+      const double s = (column + 0.5) / width - 0.5;
+      const double t = 0.5 - (row + 0.5) / height;
+      const Vec3 direction =
+          s * viewport_width * u + t * viewport_height * v - w;
+      rays.emplace_back(camera_position, direction, 0.0);
+    }
+  }
+  return rays;
+}
+
+void benchmark_aabb(BenchmarkRunner &runner, const std::vector<Ray> &rays) {
+  const AxisAlignedBoundingBox box(Point3(-1, 0, -1), Point3(1, 2, 1));
+  runner.run("aabb.hit", "rays", double(rays.size()), [&](size_t iterations) {
+    size_t hits = 0;
+    for (size_t iteration = 0; iteration < iterations; ++iteration) {
+      for (const auto &ray : rays) {
+        hits += box.hit(ray, Interval(0.001, infinity));
+      }
+    }
+    do_not_optimize(hits);
+  });
+
+  // Traversal sets up the query once and tests it against many boxes
+  std::vector<RayQuery> queries;
+  queries.reserve(rays.size());
+  for (const auto &ray : rays) {
+    queries.emplace_back(ray);
+  }
+  runner.run("aabb.hit.query", "rays", double(queries.size()),
+             [&](size_t iterations) {
+               size_t hits = 0;
+               for (size_t iteration = 0; iteration < iterations;
+                    ++iteration) {
+                 for (const auto &query : queries) {
+                   hits += box.hit(query, Interval(0.001, infinity));
+                 }
+               }
+               do_not_optimize(hits);
+             });
+}
+
+void benchmark_sphere(BenchmarkRunner &runner, const std::vector<Ray> &rays) {
+  const auto material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+  const Sphere static_sphere(Point3(0, 1, 0), 1.0, material);
+  const Sphere moving_sphere(Point3(0, 1, 0), Point3(0, 1.5, 0), 1.0,
+                             material);
+
+  const auto run_sphere = [&](const std::string &name, const Sphere &sphere) {
+    runner.run(name, "rays", double(rays.size()), [&](size_t iterations) {
+      HitRecord hit_record;
+      size_t hits = 0;
+      for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        for (const auto &ray : rays) {
+          hits += sphere.hit(ray, Interval(0.001, infinity), hit_record);
+        }
+      }
+      do_not_optimize(hits);
+    });
+  };
+
+  run_sphere("sphere.hit.static", static_sphere);
+  run_sphere("sphere.hit.moving", moving_sphere);
+}
+
+void benchmark_bvh(BenchmarkRunner &runner,
+                   const std::vector<Ray> &random_rays,
+                   const std::vector<Ray> &coherent_rays) {
+  const auto objects = make_sphere_field();
+
+  std::vector<std::shared_ptr<Hittable>> scratch;
+  runner.run_once(
+      "bvh.build", "primitives", double(objects.size()),
+      [&] { scratch = objects; },
+      [&] {
+        const BoundedVolumeHierarchy bvh(scratch, 0, scratch.size());
+        do_not_optimize(bvh);
+      });
+
+  scratch = objects;
+  const size_t allocations_before = allocation_count();
+  const BoundedVolumeHierarchy bvh(scratch, 0, scratch.size());
+  runner.add_counter("allocations", allocation_count() - allocations_before);
+
+  scratch = objects;
+  const CompressedBoundedVolumeHierarchy compressed_bvh(scratch, 0,
+                                                        scratch.size());
+
+  const auto run_traversal = [&](const std::string &name,
+                                 const std::vector<Ray> &rays,
+                                 const auto &bvh) {
+    runner.run(name, "rays", double(rays.size()), [&](size_t iterations) {
+      HitRecord hit_record;
+      size_t hits = 0;
+      for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        for (const auto &ray : rays) {
+          hits += bvh.hit(ray, Interval(0.001, infinity), hit_record);
+        }
+      }
+      do_not_optimize(hits);
+    });
+  };
+
+  run_traversal("bvh.traverse.random", random_rays, bvh);
+  runner.add_counter("bytes_per_primitive",
+                     double(bvh.memory_bytes()) / objects.size());
+  run_traversal("bvh.traverse.coherent", coherent_rays, bvh);
+  run_traversal("bvh.traverse.random.compressed", random_rays, compressed_bvh);
+  runner.add_counter("bytes_per_primitive",
+                     double(compressed_bvh.memory_bytes()) / objects.size());
+  run_traversal("bvh.traverse.coherent.compressed", coherent_rays,
+                compressed_bvh);
+
+  const auto run_occlusion = [&](const std::string &name,
+                                 const std::vector<Ray> &rays,
+                                 const auto &bvh) {
+    runner.run(name, "rays", double(rays.size()), [&](size_t iterations) {
+      size_t hits = 0;
+      for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        for (const auto &ray : rays) {
+          hits += bvh.occluded(ray, Interval(0.001, infinity));
+        }
+      }
+      do_not_optimize(hits);
+    });
+  };
+
+  run_occlusion("bvh.occluded.random", random_rays, bvh);
+  run_occlusion("bvh.occluded.coherent", coherent_rays, bvh);
+  run_occlusion("bvh.occluded.random.compressed", random_rays,
+                compressed_bvh);
+  run_occlusion("bvh.occluded.coherent.compressed", coherent_rays,
+                compressed_bvh);
+}
+
+void benchmark_motion_bvh(BenchmarkRunner &runner,
+                          const std::vector<Ray> &coherent_rays) {
+  const auto objects = make_moving_sphere_field();
+
+  // Spread the camera rays over the shutter interval
+  std::vector<Ray> rays;
+  rays.reserve(coherent_rays.size());
+  for (const auto &ray : coherent_rays) {
+    rays.emplace_back(ray.origin(), ray.direction(), random_double());
+  }
+
+  std::vector<std::shared_ptr<Hittable>> temporal = objects;
+  std::vector<std::shared_ptr<Hittable>> union_bounds;
+  for (const auto &object : objects) {
+    union_bounds.push_back(std::make_shared<UnionBounds>(object));
+  }
+
+  const BoundedVolumeHierarchy temporal_bvh(temporal, 0, temporal.size());
+  const BoundedVolumeHierarchy union_bvh(union_bounds, 0,
+                                         union_bounds.size());
+
+  const auto run_traversal = [&](const std::string &name,
+                                 const BoundedVolumeHierarchy &bvh) {
+    runner.run(name, "rays", double(rays.size()), [&](size_t iterations) {
+      HitRecord hit_record;
+      size_t hits = 0;
+      for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        for (const auto &ray : rays) {
+          hits += bvh.hit(ray, Interval(0.001, infinity), hit_record);
+        }
+      }
+      do_not_optimize(hits);
+    });
+
+    if constexpr (traversal_stats_enabled) {
+      traversal_stats() = TraversalStats{};
+      HitRecord hit_record;
+      for (const auto &ray : rays) {
+        bvh.hit(ray, Interval(0.001, infinity), hit_record);
+      }
+      runner.add_counter("nodes_per_ray",
+                         double(traversal_stats().m_nodes_visited) /
+                             rays.size());
+      runner.add_counter("primitives_per_ray",
+                         double(traversal_stats().m_primitives_tested) /
+                             rays.size());
+    }
+  };
+
+  run_traversal("bvh.motion.temporal", temporal_bvh);
+  run_traversal("bvh.motion.union", union_bvh);
+}
+
+void benchmark_random(BenchmarkRunner &runner) {
+  constexpr size_t batch = 1024;
+  runner.run("random_double", "samples", batch, [&](size_t iterations) {
+    double sum = 0.0;
+    for (size_t iteration = 0; iteration < iterations * batch; ++iteration) {
+      sum += random_double();
+    }
+    do_not_optimize(sum);
+  });
+}
+
+// Checkers of checkers, each level at half the scale of the one above
+std::shared_ptr<Texture> make_nested_checker(const int depth,
+                                             const double scale) {
+  if (depth == 0) {
+    return std::make_shared<SolidColor>(Color::random());
+  }
+  return std::make_shared<CheckerTexture>(
+      scale, make_nested_checker(depth - 1, scale / 2),
+      make_nested_checker(depth - 1, scale / 2));
+}
+
+void benchmark_textures(BenchmarkRunner &runner) {
+  const auto graph = make_nested_checker(4, 1.0);
+  const CompiledTexture compiled(*graph);
+
+  std::vector<Point3> points(4096);
+  for (auto &point : points) {
+    point = Point3::random(-10, 10);
+  }
+
+  const auto run_texture = [&](const std::string &name,
+                               const auto &texture) {
+    runner.run(name, "lookups", double(points.size()),
+               [&](size_t iterations) {
+                 Color sum(0, 0, 0);
+                 for (size_t iteration = 0; iteration < iterations;
+                      ++iteration) {
+                   for (const auto &point : points) {
+                     sum += texture.value(0, 0, point);
+                   }
+                 }
+                 do_not_optimize(sum);
+               });
+  };
+
+  run_texture("texture.nested_checker.graph", *graph);
+  run_texture("texture.nested_checker.compiled", compiled);
+}
+
+void benchmark_materials(BenchmarkRunner &runner) {
+  const auto checker = std::make_shared<CheckerTexture>(
+      0.32, Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+
+  const std::vector<std::pair<std::string, std::shared_ptr<Material>>>
+      materials{
+          {"lambertian", std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5))},
+          {"lambertian_checker", std::make_shared<Lambertian>(checker)},
+          {"metal", std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.3)},
+          {"dielectric", std::make_shared<Dielectric>(1.5)},
+      };
+
+  const Ray ray_in(Point3(0, 1, 5), Vec3(0.1, -0.05, -1), 0.5);
+
+  constexpr size_t batch = 1024;
+  for (const auto &[name, material] : materials) {
+    const Sphere sphere(Point3(0, 1, 0), 1.0, material);
+    HitRecord hit_record;
+    sphere.hit(ray_in, Interval(0.001, infinity), hit_record);
+
+    runner.run("material.scatter." + name, "scatters", batch,
+               [&](size_t iterations) {
+                 Color attenuation;
+                 Ray scattered;
+                 size_t scatters = 0;
+                 for (size_t iteration = 0; iteration < iterations * batch;
+                      ++iteration) {
+                   scatters += material->scatter(ray_in, hit_record,
+                                                 attenuation, scattered);
+                   do_not_optimize(scattered);
+                 }
+                 do_not_optimize(scatters);
+               });
+  }
+}
+
+void benchmark_write_color(BenchmarkRunner &runner) {
+  std::vector<Color> pixels(4096);
+  for (auto &pixel : pixels) {
+    pixel = Color::random(0.0, 1.2);
+  }
+
+  DiscardBuffer discard;
+  std::ostream out(&discard);
+  runner.run("write_color", "pixels", double(pixels.size()),
+             [&](size_t iterations) {
+               for (size_t iteration = 0; iteration < iterations;
+                    ++iteration) {
+                 for (const auto &pixel : pixels) {
+                   write_color(out, pixel);
+                 }
+               }
+             });
+}
+
+// A field of small balls too big for the caches, under a wide angle camera
+// so that the bounces spread over the whole field
+std::vector<std::shared_ptr<Hittable>> make_large_sphere_field() {
+  std::vector<std::shared_ptr<Hittable>> objects;
+
+  const auto ground = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
+  objects.push_back(
+      std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, ground));
+
+  const std::vector<std::shared_ptr<Material>> materials{
+      std::make_shared<Lambertian>(Color(0.7, 0.3, 0.3)),
+      std::make_shared<Lambertian>(Color(0.3, 0.7, 0.3)),
+      std::make_shared<Metal>(Color(0.8, 0.8, 0.8), 0.2),
+  };
+  for (int a = -150; a < 150; ++a) {
+    for (int b = -150; b < 150; ++b) {
+      const Point3 center(a + 0.6 * random_double(), 0.2,
+                          b + 0.6 * random_double());
+      objects.push_back(std::make_shared<Sphere>(
+          center, 0.2, materials[size_t(random_double(0, 3))]));
+    }
+  }
+
+  return objects;
+}
+
+void benchmark_render(BenchmarkRunner &runner) {
+  auto objects = make_large_sphere_field();
+  const BoundedVolumeHierarchy bvh(objects, 0, objects.size());
+
+  // The camera reports its progress, which would drown the results
+  DiscardBuffer discard;
+  CacheMissCounter cache_misses;
+
+  for (const bool sort_rays : {false, true}) {
+    auto *log = std::clog.rdbuf(&discard);
+    Camera camera(16.0 / 9.0, 96, 8, 8, Point3(0, 3, 12), Point3(0, 0, 0),
+                  Vec3(0, 1, 0), 60);
+    std::clog.rdbuf(log);
+    camera.set_sort_rays(sort_rays);
+    const double samples =
+        double(camera.image_width()) * camera.image_height() * 8;
+
+    const auto render = [&] {
+      auto *log = std::clog.rdbuf(&discard);
+      camera.render_image(bvh);
+      std::clog.rdbuf(log);
+    };
+    runner.run_once(sort_rays ? "render.sorted" : "render.unsorted",
+                    "samples", samples, [] {}, render);
+
+    if (cache_misses.is_available()) {
+      cache_misses.reset();
+      render();
+      runner.add_counter("cache_misses_per_sample",
+                         double(cache_misses.read()) / samples);
+    }
+  }
+}
+
+void usage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " [--output FILE] [--filter NAME] [--samples N]"
+               " [--min-time SECONDS]\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string output_path;
+  std::string filter;
+  size_t num_samples = 15;
+  double min_sample_time = 0.05;
+
+  for (int index = 1; index < argc; ++index) {
+    const std::string argument = argv[index];
+    const bool has_value = index + 1 < argc;
+    if (argument == "--output" && has_value) {
+      output_path = argv[++index];
+    } else if (argument == "--filter" && has_value) {
+      filter = argv[++index];
+    } else if (argument == "--samples" && has_value) {
+      num_samples = std::max<size_t>(1, std::strtoul(argv[++index], nullptr, 10));
+    } else if (argument == "--min-time" && has_value) {
+      min_sample_time = std::strtod(argv[++index], nullptr);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  // Every run sees the same scenes and ray sets
+  seed_random_generator(benchmark_seed);
+  const auto random_rays = make_random_rays();
+  const auto coherent_rays = make_coherent_rays();
+
+  BenchmarkRunner runner(std::chrono::duration<double>(min_sample_time),
+                         num_samples, filter);
+
+  benchmark_aabb(runner, random_rays);
+  benchmark_sphere(runner, random_rays);
+  benchmark_bvh(runner, random_rays, coherent_rays);
+  benchmark_motion_bvh(runner, coherent_rays);
+  benchmark_random(runner);
+  benchmark_textures(runner);
+  benchmark_materials(runner);
+  benchmark_write_color(runner);
+  benchmark_render(runner);
+
+  if (output_path.empty()) {
+    runner.write_json(std::cout);
+  } else {
+    std::ofstream out(output_path);
+    runner.write_json(out);
+  }
+
+  return 0;
+}
@@ -2,6 +2,8 @@
 
 #include <interval.hpp>
 #include <ray.hpp>
+#include <ray_query.hpp>
+#include <traversal_stats.hpp>
 #include <vec3.hpp>
 
 class AxisAlignedBoundingBox {
@@ -25,6 +27,21 @@ public:
       , m_y(a.m_y, b.m_y)
       , m_z(a.m_z, b.m_z) {}
 
+  bool operator==(const AxisAlignedBoundingBox &) const = default;
+
+  // Linear blend of two boxes, a at alpha 0 and b at alpha 1. Contains the
+  // blend of any boxes that a and b contain.
+  static AxisAlignedBoundingBox interpolate(const AxisAlignedBoundingBox &a,
+                                            const AxisAlignedBoundingBox &b,
+                                            const double alpha) {
+    const auto blend = [alpha](const Interval &from, const Interval &to) {
+      return Interval(from.m_min + alpha * (to.m_min - from.m_min),
+                      from.m_max + alpha * (to.m_max - from.m_max));
+    };
+    return AxisAlignedBoundingBox(blend(a.m_x, b.m_x), blend(a.m_y, b.m_y),
+                                  blend(a.m_z, b.m_z));
+  }
+
   const Interval &axis_interval(const size_t axis_index) const {
     if (axis_index == 0) {
       return m_x;
@@ -35,39 +52,56 @@ public:
     return m_z;
   }
 
-  bool hit(const Ray &ray, Interval ray_t) const {
-    const Point3 &ray_origin = ray.origin();
-    const Vec3 &ray_direction = ray.direction();
-
-    for (size_t axis_index = 0; axis_index < 3; ++axis_index) {
-      const Interval &axis = axis_interval(axis_index);
-      const double d_inverse = 1.0 / ray_direction[axis_index];
-
-      const auto t0 = (axis.m_min - ray_origin[axis_index]) * d_inverse;
-      const auto t1 = (axis.m_max - ray_origin[axis_index]) * d_inverse;
-
-      if (t0 < t1) {
-        if (t0 > ray_t.m_min) {
-          ray_t.m_min = t0;
-        }
-        if (t1 < ray_t.m_max) {
-          ray_t.m_max = t1;
-        }
-      } else {
-        if (t1 > ray_t.m_min) {
-          ray_t.m_min = t1;
-        }
-        if (t0 < ray_t.m_max) {
-          ray_t.m_max = t0;
-        }
-      }
-
-      if (ray_t.m_max <= ray_t.m_min) {
-        return false;
-      }
-    }
+  bool hit(const Ray &ray, const Interval ray_t) const {
+    return hit(RayQuery(ray), ray_t);
+  }
+
+  // Slab test without branches, the near and far planes are picked by the
+  // direction's sign. A ray parallel to an axis has an infinite inverse
+  // there, which gives infinite distances, or NaN when its origin lies on
+  // the plane. The comparisons are written so that a NaN keeps the current
+  // bound rather than poisoning it.
+  bool hit(const RayQuery &query, Interval ray_t) const {
+    RT_COUNT_BOX_TEST();
+
+    const auto slab = [&](const Interval &axis, const size_t axis_index) {
+      const bool is_negative = query.direction_is_negative(axis_index);
+      const double near = is_negative ? axis.m_max : axis.m_min;
+      const double far = is_negative ? axis.m_min : axis.m_max;
+      const double origin = query.origin()[axis_index];
+      const double inverse = query.inverse_direction()[axis_index];
+
+      const double t_near = (near - origin) * inverse;
+      const double t_far = (far - origin) * inverse;
+      ray_t.m_min = t_near > ray_t.m_min ? t_near : ray_t.m_min;
+      ray_t.m_max = t_far < ray_t.m_max ? t_far : ray_t.m_max;
+    };
+    slab(m_x, 0);
+    slab(m_y, 1);
+    slab(m_z, 2);
+
+    return ray_t.m_min < ray_t.m_max;
+  }
+
+  // Grows every axis thinner than delta to delta, keeping it centered
+  AxisAlignedBoundingBox padded(const double delta) const {
+    const auto pad = [delta](Interval axis) {
+      return axis.size() < delta ? axis.expand(delta - axis.size()) : axis;
+    };
+    return AxisAlignedBoundingBox(pad(m_x), pad(m_y), pad(m_z));
+  }
+
+  // False for boxes reaching to infinity, such as the one around a plane
+  bool is_bounded() const {
+    return m_x.size() < infinity && m_y.size() < infinity &&
+           m_z.size() < infinity;
+  }
 
-    return true;
+  double surface_area() const {
+    const double x = m_x.size();
+    const double y = m_y.size();
+    const double z = m_z.size();
+    return 2.0 * (x * y + y * z + z * x);
   }
 
   size_t longest_axis() const {
@@ -1,33 +1,261 @@
 #pragma once
 
 #include <aabb.hpp>
+#include <bvh_common.hpp>
 #include <constants.hpp>
 #include <hittable.hpp>
 #include <hittable_list.hpp>
 #include <interval.hpp>
+#include <quad.hpp>
 #include <ray.hpp>
+#include <sphere.hpp>
+#include <tracer.hpp>
+#include <traversal_stats.hpp>
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
-class BoundedVolumeHierarchyNode : public Hittable {
+template <typename... t_Primitives>
+class BasicCompressedBoundedVolumeHierarchy;
+
+// A bounding volume hierarchy over a closed set of primitive types. The
+// nodes live in one array in depth first order and refer to their children
+// by a tagged index, so traversal calls the concrete, final primitives'
+// intersection routines directly and the compiler can inline them. Objects
+// of any other type are still accepted and go through the virtual Hittable
+// interface, which is how nested hierarchies and wrappers fit in. Unbounded
+// objects such as planes are kept out of the tree and tested next to it,
+// their infinite boxes would otherwise cover every node up to the root.
+template <typename... t_Primitives>
+class BasicBoundedVolumeHierarchy : public Hittable {
 public:
-  BoundedVolumeHierarchyNode(HittableList hittable_list)
-      : BoundedVolumeHierarchyNode(hittable_list.m_objects, 0,
-                                   hittable_list.m_objects.size()) {
-    // Do we need to make copy of HittableList here?
+  BasicBoundedVolumeHierarchy(HittableList hittable_list)
+      : BasicBoundedVolumeHierarchy(hittable_list.m_objects, 0,
+                                    hittable_list.m_objects.size()) {}
+
+  // Sorts objects in [start, end) along the way
+  BasicBoundedVolumeHierarchy(std::vector<std::shared_ptr<Hittable>> &objects,
+                              const size_t start, const size_t end) {
+    auto bounded_end = std::begin(objects) + end;
+    {
+      const TraceScope trace("bvh.partition", "scene");
+      bounded_end = std::stable_partition(
+          std::begin(objects) + start, bounded_end, [](const auto &object) {
+            return object->bounding_box().is_bounded();
+          });
+      for (auto object = bounded_end; object != std::begin(objects) + end;
+           ++object) {
+        m_owned_objects.push_back(*object);
+        m_unbounded_objects.push_back(object->get());
+      }
+    }
+
+    const size_t num_bounded = bounded_end - (std::begin(objects) + start);
+    if (num_bounded > 0) {
+      const TraceScope trace("bvh.build", "scene", num_bounded);
+      m_nodes.reserve(num_bounded);
+      m_built_surface_areas.reserve(num_bounded);
+      build(objects, start, start + num_bounded);
+    }
+  }
+
+  bool hit(const Ray &ray, const Interval ray_t,
+           HitRecord &hit_record) const override {
+    return hit(RayQuery(ray), ray_t, hit_record);
+  }
+
+  bool occluded(const Ray &ray, const Interval ray_t) const override {
+    return occluded(RayQuery(ray), ray_t);
+  }
+
+  // For callers that already have a RayQuery, such as a tree of trees
+  bool hit(const RayQuery &query, Interval ray_t,
+           HitRecord &hit_record) const {
+    // Usually a ground plane, which is cheap and shortens the rays that go
+    // down before they enter the tree
+    bool hit_anything = false;
+    for (const auto *object : m_unbounded_objects) {
+      if (object->hit(query, ray_t, hit_record)) {
+        hit_anything = true;
+        ray_t.m_max = hit_record.m_t;
+      }
+    }
+
+    BvhNodeStack stack;
+    if (!m_nodes.empty()) {
+      stack.push(0);
+    }
+    while (!stack.empty()) {
+      RT_COUNT_NODE_VISIT();
+      const Node &node = m_nodes[stack.pop()];
+      if (!bvh_node_hit(node, query, ray_t)) {
+        continue;
+      }
+
+      // The right subtree goes on the stack first, so the left one is
+      // searched first
+      if (node.m_num_primitives == 0) {
+        stack.push(node.m_children[1].m_index);
+        stack.push(node.m_children[0].m_index);
+        continue;
+      }
+      for (unsigned int side = 0; side < node.m_num_primitives; ++side) {
+        if (visit_primitive(node.m_children[side],
+                            [&](const auto &primitive) {
+                              return primitive.hit(query, ray_t, hit_record);
+                            })) {
+          hit_anything = true;
+          ray_t.m_max = hit_record.m_t;
+        }
+      }
+    }
+    return hit_anything;
+  }
+
+  bool occluded(const RayQuery &query, const Interval ray_t) const {
+    for (const auto *object : m_unbounded_objects) {
+      if (object->occluded(query, ray_t)) {
+        return true;
+      }
+    }
+
+    BvhNodeStack stack;
+    if (!m_nodes.empty()) {
+      stack.push(0);
+    }
+    while (!stack.empty()) {
+      RT_COUNT_NODE_VISIT();
+      const Node &node = m_nodes[stack.pop()];
+      if (!bvh_node_hit(node, query, ray_t)) {
+        continue;
+      }
+
+      if (node.m_num_primitives == 0) {
+        stack.push(node.m_children[1].m_index);
+        stack.push(node.m_children[0].m_index);
+        continue;
+      }
+      for (unsigned int side = 0; side < node.m_num_primitives; ++side) {
+        if (visit_primitive(node.m_children[side],
+                            [&](const auto &primitive) {
+                              return primitive.occluded(query, ray_t);
+                            })) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  AxisAlignedBoundingBox bounding_box() const override {
+    if (!m_unbounded_objects.empty()) {
+      return AxisAlignedBoundingBox::universe;
+    }
+    return m_nodes.empty() ? AxisAlignedBoundingBox::empty
+                           : m_nodes.front().m_bounding_box;
+  }
+
+  std::array<AxisAlignedBoundingBox, 2> motion_bounds() const override {
+    if (!m_unbounded_objects.empty() || m_nodes.empty()) {
+      const auto box = bounding_box();
+      return {box, box};
+    }
+    return m_nodes.front().m_motion_bounds;
   }
 
-  BoundedVolumeHierarchyNode(std::vector<std::shared_ptr<Hittable>> &objects,
-                             const size_t start, const size_t end) {
-    m_bounding_box = AxisAlignedBoundingBox::empty;
+  // Recomputes every node's bounds bottom up after the primitives have
+  // moved, keeping the tree's topology
+  void refit() {
+    // Children always come after their parent
+    for (size_t index = m_nodes.size(); index-- > 0;) {
+      auto &node = m_nodes[index];
+      node.m_bounding_box =
+          AxisAlignedBoundingBox(child_bounding_box(node.m_children[0]),
+                                 child_bounding_box(node.m_children[1]));
+      update_motion_bounds(node);
+    }
+  }
+
+  // Mean over all nodes of how much their surface area has grown since the
+  // tree was built. Refitting keeps the tree correct but lets nodes swell as
+  // their primitives drift apart, once this gets large a rebuild pays off.
+  // Every node counts the same, so a huge primitive near the root can't hide
+  // the growth of the small nodes below it.
+  double refit_growth() const {
+    if (m_nodes.empty()) {
+      return 1.0;
+    }
+    double total_growth = 0.0;
+    for (size_t index = 0; index < m_nodes.size(); ++index) {
+      total_growth +=
+          m_built_surface_areas[index] > 0
+              ? m_nodes[index].m_bounding_box.surface_area() /
+                    m_built_surface_areas[index]
+              : 1.0;
+    }
+    return total_growth / m_nodes.size();
+  }
+
+  // In the order the tree took them in, which only depends on the objects
+  void
+  collect_primitives(std::vector<const Hittable *> &primitives) const override {
+    for (const auto &object : m_owned_objects) {
+      object->collect_primitives(primitives);
+    }
+  }
+
+  size_t num_nodes() const { return m_nodes.size(); }
+
+  // Heap memory of the tree itself, the objects it points at not included
+  size_t memory_bytes() const {
+    return m_nodes.capacity() * sizeof(Node) +
+           m_built_surface_areas.capacity() * sizeof(double) +
+           m_primitives.memory_bytes() +
+           m_unbounded_objects.capacity() * sizeof(const Hittable *) +
+           m_owned_objects.capacity() * sizeof(std::shared_ptr<Hittable>);
+  }
+
+private:
+  // Takes the primitives and reads the nodes when it compresses a tree
+  friend class BasicCompressedBoundedVolumeHierarchy<t_Primitives...>;
+
+  // What a child slot holds: another node or one of the primitives
+  struct ChildReference {
+    std::uint32_t m_kind;
+    std::uint32_t m_index;
+  };
+
+  static constexpr std::uint32_t node_kind = 0;
+
+  struct Node {
+    AxisAlignedBoundingBox m_bounding_box;
+    // Bounds at time 0 and 1, blended to the ray's time during traversal
+    std::array<AxisAlignedBoundingBox, 2> m_motion_bounds;
+    bool m_is_moving;
+    // Zero for inner nodes, whose children are both nodes. Leaves hold one
+    // or two primitives, a single one sits on both sides.
+    std::uint8_t m_num_primitives;
+    std::array<ChildReference, 2> m_children;
+  };
+
+  std::uint32_t build(std::vector<std::shared_ptr<Hittable>> &objects,
+                      const size_t start, const size_t end) {
+    // The vector may grow while the children are built, so hold on to the
+    // index rather than a reference
+    const auto node_index = std::uint32_t(m_nodes.size());
+    m_nodes.emplace_back();
+    m_built_surface_areas.emplace_back();
+
+    AxisAlignedBoundingBox bounding_box = AxisAlignedBoundingBox::empty;
     for (size_t index = start; index < end; ++index) {
-      m_bounding_box = AxisAlignedBoundingBox(m_bounding_box,
-                                              objects[index]->bounding_box());
+      bounding_box =
+          AxisAlignedBoundingBox(bounding_box, objects[index]->bounding_box());
     }
 
-    const int axis = m_bounding_box.longest_axis();
+    const int axis = bounding_box.longest_axis();
 
     const auto comparator = (axis == 0)   ? box_x_compare
                             : (axis == 1) ? box_y_compare
@@ -35,43 +263,72 @@ public:
 
     const size_t object_span = end - start;
 
+    std::array<ChildReference, 2> children;
+    std::uint8_t num_primitives = 0;
     if (object_span == 1) {
-      m_left = objects[start];
-      m_right = objects[start];
+      children[0] = add_primitive(objects[start]);
+      children[1] = children[0];
+      num_primitives = 1;
     } else if (object_span == 2) {
-      m_left = objects[start];
-      m_right = objects[start + 1];
+      children[0] = add_primitive(objects[start]);
+      children[1] = add_primitive(objects[start + 1]);
+      num_primitives = 2;
     } else {
       std::sort(std::begin(objects) + start, std::begin(objects) + end,
                 comparator);
 
       const auto midpoint = start + object_span / 2;
-      m_left = std::make_shared<BoundedVolumeHierarchyNode>(objects, start,
-                                                            midpoint);
-      m_right =
-          std::make_shared<BoundedVolumeHierarchyNode>(objects, midpoint, end);
+      children[0] = ChildReference{node_kind, build(objects, start, midpoint)};
+      children[1] = ChildReference{node_kind, build(objects, midpoint, end)};
     }
+
+    auto &node = m_nodes[node_index];
+    node.m_bounding_box = bounding_box;
+    node.m_num_primitives = num_primitives;
+    node.m_children = children;
+    update_motion_bounds(node);
+    m_built_surface_areas[node_index] = bounding_box.surface_area();
+    return node_index;
   }
 
-  bool hit(const Ray &ray, Interval ray_t,
-           HitRecord &hit_record) const override {
-    if (!m_bounding_box.hit(ray, ray_t)) {
-      return false;
-    }
+  ChildReference add_primitive(const std::shared_ptr<Hittable> &object) {
+    m_owned_objects.push_back(object);
+    const auto [kind, index] = m_primitives.add(object.get());
+    return ChildReference{kind, index};
+  }
 
-    const bool hit_left = m_left->hit(ray, ray_t, hit_record);
-    const bool hit_right = m_right->hit(
-        ray, Interval(ray_t.m_min, hit_left ? hit_record.m_t : ray_t.m_max),
-        hit_record);
+  // Calls function with the child primitive as its concrete type
+  template <typename t_Function>
+  auto visit_primitive(const ChildReference child,
+                       const t_Function &function) const {
+    return m_primitives.visit(child.m_kind, child.m_index, function);
+  }
 
-    return hit_left || hit_right;
+  AxisAlignedBoundingBox child_bounding_box(const ChildReference child) const {
+    if (child.m_kind == node_kind) {
+      return m_nodes[child.m_index].m_bounding_box;
+    }
+    return visit_primitive(
+        child, [](const auto &primitive) { return primitive.bounding_box(); });
   }
 
-  AxisAlignedBoundingBox bounding_box() const override {
-    return m_bounding_box;
+  std::array<AxisAlignedBoundingBox, 2>
+  child_motion_bounds(const ChildReference child) const {
+    if (child.m_kind == node_kind) {
+      return m_nodes[child.m_index].m_motion_bounds;
+    }
+    return visit_primitive(
+        child, [](const auto &primitive) { return primitive.motion_bounds(); });
+  }
+
+  void update_motion_bounds(Node &node) const {
+    const auto left = child_motion_bounds(node.m_children[0]);
+    const auto right = child_motion_bounds(node.m_children[1]);
+    node.m_motion_bounds = {AxisAlignedBoundingBox(left[0], right[0]),
+                            AxisAlignedBoundingBox(left[1], right[1])};
+    node.m_is_moving = !(node.m_motion_bounds[0] == node.m_motion_bounds[1]);
   }
 
-private:
   static bool box_compare(const std::shared_ptr<Hittable> a,
                           const std::shared_ptr<Hittable> b,
                           const int axis_index) {
@@ -96,7 +353,15 @@ private:
   }
 
 private:
-  std::shared_ptr<Hittable> m_left;
-  std::shared_ptr<Hittable> m_right;
-  AxisAlignedBoundingBox m_bounding_box;
+  std::vector<Node> m_nodes;
+  // Only read by refit_growth, kept out of the nodes traversal touches
+  std::vector<double> m_built_surface_areas;
+  BvhPrimitives<t_Primitives...> m_primitives;
+  std::vector<const Hittable *> m_unbounded_objects;
+  // Keeps everything the tree points at alive
+  std::vector<std::shared_ptr<Hittable>> m_owned_objects;
 };
+
+// The primitives the renderer knows, anything else goes through the virtual
+// interface
+using BoundedVolumeHierarchy = BasicBoundedVolumeHierarchy<Sphere, Quad>;
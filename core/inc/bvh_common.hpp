@@ -0,0 +1,113 @@
+#pragma once
+
+#include <aabb.hpp>
+#include <hittable.hpp>
+#include <interval.hpp>
+#include <ray_query.hpp>
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// What the eager, lazy and compressed hierarchies share
+
+// The nodes a traversal has yet to visit. The median split halves the
+// objects at every level, so a tree over any number of objects that fits in
+// memory is far less than 64 deep.
+class BvhNodeStack {
+public:
+  static constexpr size_t capacity = 64;
+
+  bool empty() const { return m_size == 0; }
+  void push(const std::uint32_t node_index) {
+    if (m_size == capacity) {
+      throw std::length_error("BVH is deeper than its traversal stack");
+    }
+    m_entries[m_size++] = node_index;
+  }
+  std::uint32_t pop() { return m_entries[--m_size]; }
+
+private:
+  std::array<std::uint32_t, capacity> m_entries;
+  size_t m_size = 0;
+};
+
+// Moving subtrees are culled by their bounds at the ray's time, which can
+// be far tighter than the box around their whole motion
+inline bool
+bvh_bounds_hit(const bool is_moving,
+               const std::array<AxisAlignedBoundingBox, 2> &motion_bounds,
+               const AxisAlignedBoundingBox &bounding_box,
+               const RayQuery &query, const Interval ray_t) {
+  return is_moving ? AxisAlignedBoundingBox::interpolate(
+                         motion_bounds[0], motion_bounds[1], query.time())
+                         .hit(query, ray_t)
+                   : bounding_box.hit(query, ray_t);
+}
+
+// For nodes that keep their box and their motion bounds at full precision
+template <typename t_Node>
+bool bvh_node_hit(const t_Node &node, const RayQuery &query,
+                  const Interval ray_t) {
+  return bvh_bounds_hit(node.m_is_moving, node.m_motion_bounds,
+                        node.m_bounding_box, query, ray_t);
+}
+
+// The primitives a hierarchy's leaves point at, an array for each of the
+// listed types and one for any other Hittable. A leaf names a primitive by
+// its kind, one more than its type's place in the list or other_kind, and
+// its index in that kind's array. Kind zero is left for inner nodes.
+template <typename... t_Primitives> class BvhPrimitives {
+public:
+  static constexpr std::uint32_t other_kind = sizeof...(t_Primitives) + 1;
+
+  // Returns the kind and the index the object was given
+  template <size_t t_Type = 0>
+  std::pair<std::uint32_t, std::uint32_t> add(const Hittable *object) {
+    if constexpr (t_Type == sizeof...(t_Primitives)) {
+      m_other_objects.push_back(object);
+      return {other_kind, std::uint32_t(m_other_objects.size() - 1)};
+    } else {
+      using t_Primitive =
+          std::tuple_element_t<t_Type, std::tuple<t_Primitives...>>;
+      if (const auto *primitive = dynamic_cast<const t_Primitive *>(object)) {
+        auto &primitives = std::get<t_Type>(m_primitives);
+        primitives.push_back(primitive);
+        return {t_Type + 1, std::uint32_t(primitives.size() - 1)};
+      }
+      return add<t_Type + 1>(object);
+    }
+  }
+
+  // Calls function with the primitive as its concrete type, so a final
+  // type's intersection routine can be inlined
+  template <size_t t_Type = 0, typename t_Function>
+  auto visit(const std::uint32_t kind, const std::uint32_t index,
+             const t_Function &function) const {
+    if constexpr (t_Type == sizeof...(t_Primitives)) {
+      return function(*m_other_objects[index]);
+    } else {
+      if (kind == t_Type + 1) {
+        return function(*std::get<t_Type>(m_primitives)[index]);
+      }
+      return visit<t_Type + 1>(kind, index, function);
+    }
+  }
+
+  size_t memory_bytes() const {
+    size_t bytes = m_other_objects.capacity() * sizeof(const Hittable *);
+    std::apply(
+        [&](const auto &...primitives) {
+          ((bytes += primitives.capacity() * sizeof(primitives.front())), ...);
+        },
+        m_primitives);
+    return bytes;
+  }
+
+private:
+  std::tuple<std::vector<const t_Primitives *>...> m_primitives;
+  std::vector<const Hittable *> m_other_objects;
+};
@@ -1,15 +1,56 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <string>
 
+#include <checkpoint.hpp>
 #include <color.hpp>
+#include <denoiser.hpp>
 #include <hittable.hpp>
+#include <image.hpp>
 #include <interval.hpp>
+#include <light_list.hpp>
 #include <material.hpp>
+#include <primary_hits.hpp>
+#include <ray_sorting.hpp>
+#include <thread_placement.hpp>
 #include <thread_pool.hpp>
+#include <tracer.hpp>
+#include <traversal_stats.hpp>
 #include <vec3.hpp>
 
+enum class RenderMode {
+  Shaded,
+  // False colour images of the BVH nodes visited or the primitives tested by
+  // each primary ray, these need a build with RT_TRAVERSAL_STATS
+  NodeHeatmap,
+  PrimitiveHeatmap,
+};
+
+struct ProgressiveSettings {
+  unsigned int m_samples_per_pass = 1;
+  // Wall clock time after which no more samples are started, zero for none
+  std::chrono::duration<double> m_time_budget{0};
+  // Zero disables snapshots
+  std::chrono::duration<double> m_snapshot_interval{0};
+  std::string m_snapshot_path;
+  // Every sample's random stream is derived from this and its position
+  std::uint64_t m_sample_seed = 0x5eed;
+  // An empty path disables checkpoints, a zero interval only writes the
+  // final one
+  std::string m_checkpoint_path;
+  std::chrono::duration<double> m_checkpoint_interval{0};
+  bool m_resume = false;
+  // Identifies the world, combined with the camera's own configuration hash
+  std::uint64_t m_scene_hash = 0;
+};
+
 class Camera {
 public:
   Camera(const double aspect_ratio = 1.0, const unsigned int image_width = 100,
@@ -26,6 +67,8 @@ public:
             1, (unsigned int)(m_image_width / m_aspect_ratio)))
       , m_image_matrix(m_image_width * m_image_height, Color(0, 0, 0))
       , m_camera_position(camera_position)
+      , m_looking_at(looking_at)
+      , m_up_direction(up_direction)
       , m_defocus_angle(defocus_angle)
       , m_focus_dist(focus_dist)
       , m_frame_basis(
@@ -46,46 +89,893 @@ public:
       , m_samples_per_pixel(std::max<unsigned int>(1, samples_per_pixel))
       , m_pixel_samples_scale(1.0 / m_samples_per_pixel)
       , m_max_depth(max_depth)
-      , m_thread_pool(std::make_unique<ThreadPool>()) {}
+      , m_thread_pool(std::make_shared<ThreadPool>()) {}
 
   void render(const Hittable &world) {
-    m_thread_pool->start();
-    std::cout << "P3\n" << m_image_width << " " << m_image_height << "\n255\n";
+    render_image(world);
+    write_image(std::cout);
+  }
 
-    for (unsigned int row = 0; row < m_image_height; ++row) {
-      std::clog << "\rScanline: " << row + 1 << " / " << m_image_height
-                << std::flush;
-      m_thread_pool->add_job([this, row, &world] { render_row(row, world); });
+  // Fill the image matrix without writing it anywhere
+  void render_image(const Hittable &world) {
+    const TraceScope trace("render_image", "render");
+    prepare_primary_hits(world);
+    start_threads();
+    m_row_samples.assign(m_image_height, m_samples_per_pixel);
+    reset_luminance_moments(m_samples_per_pixel);
+
+    if (m_thread_pool->placement() == ThreadPlacement::None) {
+      for (unsigned int row = 0; row < m_image_height; ++row) {
+        std::clog << "\rScanline: " << row + 1 << " / " << m_image_height
+                  << std::flush;
+        m_thread_pool->add_job(
+            [this, row, &world] { render_row(row, world); });
+      }
+      // Anything after the last row starts is the stragglers' tail
+      const TraceScope trace_wait("wait_for_rows", "render");
+      m_thread_pool->wait_for_empty_job_queue();
+    } else {
+      render_rows_in_place(world);
     }
 
+    finish_threads();
+
+    if (m_render_mode != RenderMode::Shaded) {
+      finish_heatmap();
+    } else {
+      post_process(world);
+    }
+  }
+
+  // Renders only rows [row_begin, row_end) and returns their pixels
+  std::vector<Color> render_rows(const Hittable &world,
+                                 const unsigned int row_begin,
+                                 const unsigned int row_end) {
+    m_primary_hit_mode = PrimaryHitMode::Off;
+    start_threads();
+    for (unsigned int row = row_begin; row < row_end; ++row) {
+      m_thread_pool->add_job([this, row, &world] { render_row(row, world); });
+    }
     m_thread_pool->wait_for_empty_job_queue();
-    m_thread_pool->stop();
+    finish_threads();
+
+    return std::vector<Color>(
+        std::begin(m_image_matrix) + size_t(row_begin) * m_image_width,
+        std::begin(m_image_matrix) + size_t(row_end) * m_image_width);
+  }
+
+  // Renders the whole frame in passes of a few samples per pixel into the
+  // accumulation buffer until the time budget runs out or samples_per_pixel
+  // is reached, then resolves the best image so far into the image matrix.
+  // Every sample draws from a stream seeded by its pixel and sample index,
+  // so the result doesn't depend on the thread schedule and a render resumed
+  // from a checkpoint matches an uninterrupted one. Returns the samples per
+  // pixel achieved by every row.
+  unsigned int render_progressive(const Hittable &world,
+                                  const ProgressiveSettings &settings) {
+    using t_Clock = std::chrono::steady_clock;
+
+    const auto start = t_Clock::now();
+    const auto deadline =
+        settings.m_time_budget.count() > 0
+            ? start + std::chrono::duration_cast<t_Clock::duration>(
+                          settings.m_time_budget)
+            : t_Clock::time_point::max();
+    auto last_snapshot = start;
+    auto last_checkpoint = start;
+    std::future<void> snapshot_writer;
+    std::future<bool> checkpoint_writer;
+
+    m_accumulation.assign(m_image_matrix.size(), Color(0, 0, 0));
+    m_row_samples.assign(m_image_height, 0);
+    reset_luminance_moments(0);
+    m_sample_seed = settings.m_sample_seed;
+
+    if (settings.m_resume && !settings.m_checkpoint_path.empty()) {
+      resume_from_checkpoint(settings);
+    }
+
+    start_threads();
+
+    // Checks whether the previous background write is done, so that a slow
+    // disk makes us skip a write rather than stall the workers
+    const auto is_idle = [](const auto &writer) {
+      return !writer.valid() || writer.wait_for(std::chrono::seconds(0)) ==
+                                    std::future_status::ready;
+    };
+
+    while (*std::min_element(std::begin(m_row_samples),
+                             std::end(m_row_samples)) < m_samples_per_pixel) {
+      const auto pass_start = t_Clock::now();
+      for (unsigned int row = 0; row < m_image_height; ++row) {
+        m_thread_pool->add_job([this, row, &settings, deadline, &world] {
+          const unsigned int samples =
+              std::min(settings.m_samples_per_pass,
+                       m_samples_per_pixel - m_row_samples[row]);
+          // Rows that would start past the deadline are dropped and keep the
+          // samples of the earlier passes. A row without any samples is
+          // always rendered so that there is an image to write at all.
+          if (samples > 0 &&
+              (m_row_samples[row] == 0 || t_Clock::now() < deadline)) {
+            accumulate_row(row, samples, world);
+          }
+        });
+      }
+      {
+        const TraceScope trace_wait("wait_for_pass", "render");
+        m_thread_pool->wait_for_empty_job_queue();
+      }
+
+      const auto now = t_Clock::now();
+      std::clog << "\rProgressive: "
+                << *std::min_element(std::begin(m_row_samples),
+                                     std::end(m_row_samples))
+                << " spp in "
+                << std::chrono::duration<double>(now - start).count() << "s"
+                << std::flush;
+
+      // Don't start a pass that is not expected to finish in time
+      if (now + (now - pass_start) > deadline) {
+        break;
+      }
+
+      if (settings.m_snapshot_interval.count() > 0 &&
+          now - last_snapshot >= settings.m_snapshot_interval &&
+          is_idle(snapshot_writer)) {
+        last_snapshot = now;
+        snapshot_writer = write_snapshot(settings.m_snapshot_path);
+      }
+
+      if (!settings.m_checkpoint_path.empty() &&
+          settings.m_checkpoint_interval.count() > 0 &&
+          now - last_checkpoint >= settings.m_checkpoint_interval &&
+          is_idle(checkpoint_writer)) {
+        last_checkpoint = now;
+        checkpoint_writer =
+            std::async(std::launch::async, write_checkpoint,
+                       settings.m_checkpoint_path, make_checkpoint(settings));
+      }
+    }
+
+    finish_threads();
+
+    if (snapshot_writer.valid()) {
+      snapshot_writer.wait();
+    }
+    if (checkpoint_writer.valid()) {
+      checkpoint_writer.wait();
+    }
+
+    // A render cut short by its budget can be resumed later for more samples
+    if (!settings.m_checkpoint_path.empty() &&
+        !write_checkpoint(settings.m_checkpoint_path,
+                          make_checkpoint(settings))) {
+      std::cerr << "\nCould not write checkpoint "
+                << settings.m_checkpoint_path << std::endl;
+    }
+
+    resolve_accumulation();
+    post_process(world);
+
+    const unsigned int achieved =
+        *std::min_element(std::begin(m_row_samples), std::end(m_row_samples));
+    std::clog << "\rProgressive: " << achieved << " spp achieved in "
+              << std::chrono::duration<double>(t_Clock::now() - start).count()
+              << "s" << std::endl;
+    return achieved;
+  }
+
+  // Identifies everything about the camera that changes the image, apart
+  // from the sample count, so a checkpoint is only resumed by a matching one
+  std::uint64_t configuration_hash() const {
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    const auto add = [&hash](const double value) {
+      hash = hash_combine(hash, value);
+    };
+    add(m_image_width);
+    add(m_image_height);
+    add(m_max_depth);
+    add(m_defocus_angle);
+    add(m_focus_dist);
+    add(m_vertical_field_of_view);
+    for (const auto &vector : {m_camera_position, m_frame_basis[0],
+                               m_frame_basis[1], m_frame_basis[2]}) {
+      add(vector.x());
+      add(vector.y());
+      add(vector.z());
+    }
+    return hash;
+  }
+
+  // Full frame renders record the primary hit of every sample into the
+  // buffer, or if it already holds those of this camera and the world's
+  // geometry, shade them from it instead of tracing the primary rays. Each
+  // sample then draws from a stream seeded by its pixel and index, so that
+  // it makes the same ray every time.
+  void set_primary_hits(std::shared_ptr<PrimaryHitBuffer> primary_hits) {
+    m_primary_hits = std::move(primary_hits);
+  }
+
+  // Whether the last full frame render shaded the buffer's primary hits
+  bool replayed_primary_hits() const {
+    return m_primary_hit_mode == PrimaryHitMode::Replay;
+  }
+
+  // The header of the buffer this camera records over the world, without a
+  // sample seed or hits, for checking a file before reading it
+  PrimaryHitBuffer primary_hits_header(const Hittable &world) const {
+    return primary_hits_header(PrimitiveTable(world));
+  }
+
+  const Point3 &camera_position() const { return m_camera_position; }
+  const Point3 &looking_at() const { return m_looking_at; }
+  double vertical_field_of_view() const { return m_vertical_field_of_view; }
+
+  // The same camera moved and turned, with this one's image size, samples,
+  // depth, up direction and lens. Only the view is copied, make it before
+  // setting anything else.
+  Camera with_view(const Point3 &camera_position, const Point3 &looking_at,
+                   const double vertical_field_of_view) const {
+    return Camera(m_aspect_ratio, m_image_width, m_samples_per_pixel,
+                  m_max_depth, camera_position, looking_at, m_up_direction,
+                  vertical_field_of_view, m_defocus_angle, m_focus_dist);
+  }
+
+  // Traces each row's secondary rays in batches sorted for coherence, see
+  // render_row_sorted
+  void set_sort_rays(const bool sort_rays) { m_sort_rays = sort_rays; }
 
+  // Zero threads means the pool's default
+  void set_threads(const unsigned int num_threads,
+                   const ThreadPlacement placement) {
+    m_thread_pool = std::make_shared<ThreadPool>(
+        num_threads ? num_threads : ThreadPool::default_num_threads(),
+        placement);
+  }
+
+  // Renders on a pool that outlives the camera and may be shared with others,
+  // together with set_keep_threads_alive the threads are only started once
+  void set_thread_pool(std::shared_ptr<ThreadPool> thread_pool) {
+    m_thread_pool = std::move(thread_pool);
+  }
+
+  // Keeps the worker threads running between renders, for sequences of
+  // frames. Otherwise they are started and joined by every render.
+  void set_keep_threads_alive(const bool keep_threads_alive) {
+    m_keep_threads_alive = keep_threads_alive;
+    if (!keep_threads_alive && m_thread_pool->is_running()) {
+      m_thread_pool->stop();
+    }
+  }
+
+  // Fills the auxiliary buffers after every full frame render
+  void set_auxiliary_buffers(const bool auxiliary_buffers) {
+    m_render_auxiliary = auxiliary_buffers;
+  }
+
+  // Denoises every full frame render, this needs the auxiliary buffers
+  void set_denoise(const bool denoise) { m_denoise = denoise; }
+
+  // Diffuse hits sample these for direct lighting, see LightList
+  void set_lights(const LightList &lights) { m_lights = lights; }
+
+  void set_render_mode(const RenderMode render_mode) {
+    m_render_mode = render_mode;
+  }
+
+  void write_image(std::ostream &out) const {
+    const TraceScope trace("write_image", "output");
     std::clog << "\rWrite to file       " << std::flush;
+    out << "P3\n" << m_image_width << " " << m_image_height << "\n255\n";
     for (const auto &color : m_image_matrix) {
-      write_color(std::cout, color);
+      write_color(out, color);
     }
     std::clog << "\rDone.                              \n";
   }
 
+  const std::vector<Color> &image() const { return m_image_matrix; }
+  FloatImage float_image() const {
+    return FloatImage{m_image_width, m_image_height, m_image_matrix};
+  }
+  unsigned int image_width() const { return m_image_width; }
+  unsigned int image_height() const { return m_image_height; }
+  unsigned int samples_per_pixel() const { return m_samples_per_pixel; }
+  const AuxiliaryBuffers &auxiliary_buffers() const { return m_auxiliary; }
+
 private:
+  enum class PrimaryHitMode { Off, Record, Replay };
+
+  void start_threads() {
+    if (!m_thread_pool->is_running()) {
+      m_thread_pool->start();
+    }
+  }
+
+  void finish_threads() {
+    if (!m_keep_threads_alive) {
+      m_thread_pool->stop();
+    }
+  }
+
+  // With pinned threads every worker renders a fixed, interleaved set of
+  // rows. The pages under the image are handed back first, so each row is
+  // first touched, and placed on the NUMA node of, the thread that renders it.
+  void render_rows_in_place(const Hittable &world) {
+    release_pages(m_image_matrix.data(),
+                  m_image_matrix.size() * sizeof(Color));
+    release_pages(m_luminance_moments.data(),
+                  m_luminance_moments.size() * sizeof(m_luminance_moments[0]));
+
+    const unsigned int num_threads = m_thread_pool->num_threads();
+    m_thread_pool->run_on_each_thread(
+        [this, num_threads, &world](const unsigned int thread) {
+          for (unsigned int row = thread; row < m_image_height;
+               row += num_threads) {
+            render_row(row, world);
+          }
+        });
+  }
+
   void render_pixel(const unsigned int row, const unsigned int column,
                     const Hittable &world) {
     const unsigned int flat_pixel_position = row * m_image_width + column;
+    if (m_render_mode != RenderMode::Shaded) {
+      render_heatmap_pixel(flat_pixel_position, row, column, world);
+      return;
+    }
+    const std::uint64_t seed = pixel_seed(row, column);
     Color pixel_color(0, 0, 0);
     for (unsigned int sample = 0; sample < m_samples_per_pixel; ++sample) {
-      Ray ray = get_ray(column, row);
-      pixel_color += ray_color(ray, m_max_depth, world);
+      PrimaryHit *primary_hit = nullptr;
+      if (m_primary_hit_mode != PrimaryHitMode::Off) {
+        seed_random_generator(RandomGenerator::mix_bits(seed + sample));
+        primary_hit =
+            &m_primary_hits->m_hits[size_t(flat_pixel_position) *
+                                        m_samples_per_pixel +
+                                    sample];
+      }
+      const Ray ray = get_ray(column, row);
+      const Color sample_color =
+          primary_hit ? primary_hit_color(ray, *primary_hit, world)
+                      : ray_color(ray, m_max_depth, world);
+      pixel_color += sample_color;
+      add_luminance_moments(flat_pixel_position, sample_color);
     }
     m_image_matrix[flat_pixel_position] = m_pixel_samples_scale * pixel_color;
   }
 
+  // Stores the mean traversal cost of the pixel's primary rays in the red
+  // channel, finish_heatmap turns it into a colour once the maximum is known
+  void render_heatmap_pixel(const unsigned int flat_pixel_position,
+                            const unsigned int row, const unsigned int column,
+                            const Hittable &world) {
+    auto &stats = traversal_stats();
+    double cost = 0.0;
+    for (unsigned int sample = 0; sample < m_samples_per_pixel; ++sample) {
+      const Ray ray = get_ray(column, row);
+      stats = TraversalStats();
+      HitRecord hit_record;
+      world.hit(ray, Interval(0.001, infinity), hit_record);
+      cost += (m_render_mode == RenderMode::NodeHeatmap)
+                  ? stats.m_nodes_visited
+                  : stats.m_primitives_tested;
+    }
+    m_image_matrix[flat_pixel_position] =
+        Color(m_pixel_samples_scale * cost, 0, 0);
+  }
+
+  void finish_heatmap() {
+    double max_cost = 0.0;
+    double total_cost = 0.0;
+    for (const auto &pixel : m_image_matrix) {
+      max_cost = std::max(max_cost, pixel.x());
+      total_cost += pixel.x();
+    }
+
+    std::clog << "\r"
+              << (m_render_mode == RenderMode::NodeHeatmap ? "Nodes visited"
+                                                           : "Primitives tested")
+              << " per ray: mean " << total_cost / m_image_matrix.size()
+              << ", max " << max_cost << std::endl;
+
+    for (auto &pixel : m_image_matrix) {
+      const Color display = false_color(max_cost > 0 ? pixel.x() / max_cost : 0);
+      // write_color applies gamma, so undo it to keep the ramp's colours
+      pixel = display * display;
+    }
+  }
+
+  // Fills the auxiliary buffers and denoises the image if enabled, with the
+  // time of each step reported separately from the render
+  void post_process(const Hittable &world) {
+    if (!m_render_auxiliary && !m_denoise) {
+      return;
+    }
+    using t_Clock = std::chrono::steady_clock;
+
+    start_threads();
+    const auto start = t_Clock::now();
+    m_auxiliary = AuxiliaryBuffers{
+        FloatImage{m_image_width, m_image_height,
+                   std::vector<Color>(m_image_matrix.size(), Color(0, 0, 0))},
+        FloatImage{m_image_width, m_image_height,
+                   std::vector<Color>(m_image_matrix.size(), Color(0, 0, 0))},
+        std::vector<double>(m_image_matrix.size(), 0.0),
+        std::vector<double>()};
+    for (unsigned int row = 0; row < m_image_height; ++row) {
+      m_thread_pool->add_job([this, row, &world] {
+        const TraceScope trace("auxiliary_row", "render", row);
+        render_auxiliary_row(row, world);
+      });
+    }
+    m_thread_pool->wait_for_empty_job_queue();
+    const auto auxiliary_done = t_Clock::now();
+
+    if (m_denoise) {
+      const TraceScope trace("denoise", "render");
+      m_auxiliary.m_variance = luminance_variance();
+      m_image_matrix = denoise(float_image(), m_auxiliary, DenoiseSettings(),
+                               *m_thread_pool)
+                           .m_pixels;
+    }
+    finish_threads();
+
+    std::clog << "\rAuxiliary buffers: "
+              << std::chrono::duration<double>(auxiliary_done - start).count()
+              << "s";
+    if (m_denoise) {
+      std::clog << ", denoising: "
+                << std::chrono::duration<double>(t_Clock::now() -
+                                                 auxiliary_done)
+                       .count()
+                << "s";
+    }
+    std::clog << std::endl;
+  }
+
+  // The denoiser's variance estimate needs the first two moments of every
+  // pixel's luminance. A resumed progressive render only has them for the
+  // samples taken since, which is still a fair estimate.
+  void reset_luminance_moments(const unsigned int samples_per_row) {
+    if (m_denoise) {
+      m_luminance_moments.assign(m_image_matrix.size(), {0.0, 0.0});
+      m_row_moment_samples.assign(m_image_height, samples_per_row);
+    }
+  }
+
+  void add_luminance_moments(const size_t index, const Color &sample_color) {
+    if (m_denoise) {
+      const double value = luminance(sample_color);
+      m_luminance_moments[index][0] += value;
+      m_luminance_moments[index][1] += value * value;
+    }
+  }
+
+  // Variance of each pixel's mean luminance. With a single sample there is
+  // nothing to estimate it from, so the noise is taken to be as large as
+  // the value itself.
+  std::vector<double> luminance_variance() const {
+    std::vector<double> variance(m_image_matrix.size(), 0.0);
+    for (unsigned int row = 0; row < m_image_height; ++row) {
+      const double samples = std::max(1u, m_row_moment_samples[row]);
+      const double total_samples = std::max(1u, m_row_samples[row]);
+      for (unsigned int column = 0; column < m_image_width; ++column) {
+        const size_t index = size_t(row) * m_image_width + column;
+        const double mean = m_luminance_moments[index][0] / samples;
+        const double sample_variance =
+            samples < 2 ? mean * mean
+                        : std::max(0.0, m_luminance_moments[index][1] / samples -
+                                            mean * mean) *
+                              samples / (samples - 1);
+        variance[index] = sample_variance / total_samples;
+      }
+    }
+    return variance;
+  }
+
+  // Averages the first hits of the pixel's jittered primary rays, up to a
+  // limit, from a fixed seed so the buffers are the same on every run
+  void render_auxiliary_row(const unsigned int row, const Hittable &world) {
+    constexpr unsigned int max_auxiliary_samples = 64;
+    constexpr unsigned int max_auxiliary_bounces = 4;
+    const unsigned int samples =
+        std::min(m_samples_per_pixel, max_auxiliary_samples);
+
+    for (unsigned int column = 0; column < m_image_width; ++column) {
+      const size_t index = size_t(row) * m_image_width + column;
+      seed_random_generator(RandomGenerator::mix_bits(~index));
+
+      Color albedo(0, 0, 0);
+      Vec3 normal(0, 0, 0);
+      double depth = 0.0;
+      for (unsigned int sample = 0; sample < samples; ++sample) {
+        Ray ray = get_ray(column, row);
+        HitRecord hit_record;
+        if (!world.hit(ray, Interval(0.001, infinity), hit_record)) {
+          albedo += background(ray);
+          continue;
+        }
+        depth += hit_record.m_t * ray.direction().length();
+
+        // Look through mirrors and glass to the first surface that isn't
+        // specular, whose features are what the noise lies on
+        Color throughput(1, 1, 1);
+        for (unsigned int bounce = 0;; ++bounce) {
+          BsdfSample bsdf_sample;
+          const Material &material = *hit_record.m_material;
+          if (bounce == max_auxiliary_bounces ||
+              !material.sample(ray, hit_record, bsdf_sample) ||
+              !bsdf_sample.m_is_specular) {
+            albedo += throughput * material.albedo(hit_record);
+            normal += hit_record.m_normal;
+            break;
+          }
+          throughput = throughput * bsdf_sample.m_weight;
+          ray = Ray(hit_record.m_point, bsdf_sample.m_direction, ray.time());
+          if (!world.hit(ray, Interval(0.001, infinity), hit_record)) {
+            albedo += throughput * background(ray);
+            break;
+          }
+        }
+      }
+      m_auxiliary.m_albedo.m_pixels[index] = albedo / samples;
+      m_auxiliary.m_normal.m_pixels[index] = normal / samples;
+      m_auxiliary.m_depth[index] = depth / samples;
+    }
+  }
+
   void render_row(const unsigned int row, const Hittable &world) {
+    const TraceScope trace("row", "render", row);
+    if (m_sort_rays && m_render_mode == RenderMode::Shaded &&
+        m_primary_hit_mode == PrimaryHitMode::Off) {
+      render_row_sorted(row, world);
+      return;
+    }
     for (unsigned int column = 0; column < m_image_width; ++column) {
       render_pixel(row, column, world);
     }
   }
 
+  // One sample of one pixel on its way through the scene
+  struct PathState {
+    Ray m_ray;
+    Color m_throughput;
+    Color m_radiance;
+    // See ray_color
+    double m_bsdf_pdf;
+    unsigned int m_column;
+  };
+
+  // Same estimate as render_pixel, but the paths of the row advance one
+  // bounce at a time. From the first bounce on the paths are sorted by
+  // ray_sort_key before they are traced, so consecutive rays start near each
+  // other and go the same way instead of scattering all over the BVH.
+  void render_row_sorted(const unsigned int row, const Hittable &world) {
+    // Bounds the memory of a row with many samples per pixel
+    constexpr size_t max_paths = 1 << 16;
+    const unsigned int chunk_samples = std::max<unsigned int>(
+        1, (unsigned int)(max_paths / m_image_width));
+
+    std::vector<Color> pixel_colors(m_image_width, Color(0, 0, 0));
+    const auto finish_path = [&](const PathState &path) {
+      pixel_colors[path.m_column] += path.m_radiance;
+      add_luminance_moments(row * m_image_width + path.m_column,
+                            path.m_radiance);
+    };
+
+    std::vector<PathState> paths;
+    std::vector<PathState> sorted_paths;
+    std::vector<std::pair<std::uint64_t, unsigned int>> keys;
+
+    for (unsigned int first_sample = 0; first_sample < m_samples_per_pixel;
+         first_sample += chunk_samples) {
+      const unsigned int samples =
+          std::min(chunk_samples, m_samples_per_pixel - first_sample);
+
+      // Primary rays are coherent already in pixel order
+      paths.clear();
+      for (unsigned int column = 0; column < m_image_width; ++column) {
+        for (unsigned int sample = 0; sample < samples; ++sample) {
+          paths.push_back(PathState{get_ray(column, row), Color(1, 1, 1),
+                                    Color(0, 0, 0), 0.0, column});
+        }
+      }
+
+      for (unsigned int depth = m_max_depth; depth > 0 && !paths.empty();
+           --depth) {
+        if (depth < m_max_depth) {
+          sort_paths(paths, keys, sorted_paths);
+        }
+        size_t num_active = 0;
+        for (auto &path : paths) {
+          if (extend_path(path, world)) {
+            paths[num_active++] = path;
+          } else {
+            finish_path(path);
+          }
+        }
+        paths.resize(num_active);
+      }
+
+      // Out of bounces, these carry what they gathered so far
+      for (const auto &path : paths) {
+        finish_path(path);
+      }
+    }
+
+    for (unsigned int column = 0; column < m_image_width; ++column) {
+      m_image_matrix[row * m_image_width + column] =
+          m_pixel_samples_scale * pixel_colors[column];
+    }
+  }
+
+  // Moves the paths into ray_sort_key order, so they are also traced from
+  // consecutive memory
+  static void
+  sort_paths(std::vector<PathState> &paths,
+             std::vector<std::pair<std::uint64_t, unsigned int>> &keys,
+             std::vector<PathState> &sorted_paths) {
+    AxisAlignedBoundingBox origin_bounds = AxisAlignedBoundingBox::empty;
+    for (const auto &path : paths) {
+      const Point3 &origin = path.m_ray.origin();
+      origin_bounds = AxisAlignedBoundingBox(
+          origin_bounds, AxisAlignedBoundingBox(origin, origin));
+    }
+
+    keys.resize(paths.size());
+    for (unsigned int index = 0; index < paths.size(); ++index) {
+      keys[index] = {ray_sort_key(paths[index].m_ray, origin_bounds), index};
+    }
+    std::sort(std::begin(keys), std::end(keys));
+
+    sorted_paths.clear();
+    for (const auto &[key, index] : keys) {
+      sorted_paths.push_back(paths[index]);
+    }
+    std::swap(paths, sorted_paths);
+  }
+
+  // One bounce of ray_color, returns false once the path has ended
+  bool extend_path(PathState &path, const Hittable &world) const {
+    const Ray &ray = path.m_ray;
+    HitRecord hit_record;
+    if (!world.hit(ray, Interval(0.001, infinity), hit_record)) {
+      path.m_radiance += path.m_throughput * background(ray);
+      return false;
+    }
+
+    const Material &material = *hit_record.m_material;
+    Color radiance = material.emitted(hit_record);
+    if (path.m_bsdf_pdf > 0.0 && !radiance.near_zero() &&
+        m_lights.contains(hit_record.m_primitive)) {
+      const double light_pdf =
+          m_lights.pdf_value(ray.origin(), ray.direction(), ray.time());
+      radiance = radiance * power_heuristic(path.m_bsdf_pdf, light_pdf);
+    }
+
+    BsdfSample bsdf_sample;
+    if (!material.sample(ray, hit_record, bsdf_sample)) {
+      path.m_radiance += path.m_throughput * radiance;
+      return false;
+    }
+
+    path.m_bsdf_pdf = 0.0;
+    if (!bsdf_sample.m_is_specular && !m_lights.empty()) {
+      radiance += direct_lighting(ray, hit_record, world);
+      path.m_bsdf_pdf = bsdf_sample.m_pdf;
+    }
+    path.m_radiance += path.m_throughput * radiance;
+    path.m_throughput = path.m_throughput * bsdf_sample.m_weight;
+    path.m_ray = Ray(hit_record.m_point, bsdf_sample.m_direction, ray.time());
+    return true;
+  }
+
+  void accumulate_row(const unsigned int row, const unsigned int samples,
+                      const Hittable &world) {
+    const TraceScope trace("row", "render", row);
+    Color *row_accumulation = &m_accumulation[row * m_image_width];
+    const unsigned int first_sample = m_row_samples[row];
+    for (unsigned int column = 0; column < m_image_width; ++column) {
+      const std::uint64_t seed = pixel_seed(row, column);
+      for (unsigned int sample = first_sample; sample < first_sample + samples;
+           ++sample) {
+        seed_random_generator(RandomGenerator::mix_bits(seed + sample));
+        const Ray ray = get_ray(column, row);
+        const Color sample_color = ray_color(ray, m_max_depth, world);
+        row_accumulation[column] += sample_color;
+        add_luminance_moments(row * m_image_width + column, sample_color);
+      }
+    }
+    m_row_samples[row] += samples;
+    if (m_denoise) {
+      m_row_moment_samples[row] += samples;
+    }
+  }
+
+  // Sample n of the pixel draws from a stream seeded with this plus n
+  std::uint64_t pixel_seed(const unsigned int row,
+                           const unsigned int column) const {
+    return RandomGenerator::mix_bits(
+        m_sample_seed ^ (std::uint64_t(row) * m_image_width + column));
+  }
+
+  PrimaryHitBuffer primary_hits_header(const PrimitiveTable &table) const {
+    PrimaryHitBuffer header;
+    header.m_configuration_hash = RandomGenerator::mix_bits(
+        configuration_hash() ^ table.geometry_hash());
+    header.m_width = m_image_width;
+    header.m_height = m_image_height;
+    header.m_samples_per_pixel = m_samples_per_pixel;
+    return header;
+  }
+
+  // Replays the buffer if it was made by this camera over the same
+  // geometry, otherwise sets it up to record this render
+  void prepare_primary_hits(const Hittable &world) {
+    m_primary_hit_mode = PrimaryHitMode::Off;
+    if (!m_primary_hits || m_render_mode != RenderMode::Shaded) {
+      return;
+    }
+
+    m_primitive_table = std::make_unique<PrimitiveTable>(world);
+    const PrimaryHitBuffer header = primary_hits_header(*m_primitive_table);
+    const size_t num_hits =
+        size_t(m_image_width) * m_image_height * m_samples_per_pixel;
+
+    auto &buffer = *m_primary_hits;
+    if (buffer.m_configuration_hash == header.m_configuration_hash &&
+        buffer.m_width == m_image_width && buffer.m_height == m_image_height &&
+        buffer.m_samples_per_pixel == m_samples_per_pixel &&
+        buffer.m_hits.size() == num_hits) {
+      m_sample_seed = buffer.m_sample_seed;
+      m_primary_hit_mode = PrimaryHitMode::Replay;
+      std::clog << "Replaying primary hits" << std::endl;
+      return;
+    }
+
+    buffer.m_configuration_hash = header.m_configuration_hash;
+    buffer.m_sample_seed = m_sample_seed;
+    buffer.m_width = m_image_width;
+    buffer.m_height = m_image_height;
+    buffer.m_samples_per_pixel = m_samples_per_pixel;
+    buffer.m_hits.assign(num_hits, PrimaryHit{});
+    m_primary_hit_mode = PrimaryHitMode::Record;
+    std::clog << "Recording primary hits" << std::endl;
+  }
+
+  // ray_color for a primary ray whose hit goes into or comes from the
+  // buffer. A recorded hit is shaded as it will be replayed, with what the
+  // buffer rounded, so that replays give the very same image.
+  Color primary_hit_color(const Ray &ray, PrimaryHit &primary_hit,
+                          const Hittable &world) const {
+    if (m_max_depth == 0) {
+      return Color(0, 0, 0);
+    }
+
+    if (m_primary_hit_mode == PrimaryHitMode::Record) {
+      HitRecord hit_record{};
+      if (!world.hit(ray, Interval(0.001, infinity), hit_record)) {
+        primary_hit.m_primitive = PrimaryHit::missed;
+        return background(ray);
+      }
+      const std::uint32_t index =
+          m_primitive_table->index(hit_record.m_primitive);
+      if (index == PrimaryHit::untracked) {
+        primary_hit.m_primitive = PrimaryHit::untracked;
+        return shade(ray, hit_record, m_max_depth, world);
+      }
+      primary_hit = PrimaryHit{
+          hit_record.m_t,
+          {float(hit_record.m_normal.x()), float(hit_record.m_normal.y()),
+           float(hit_record.m_normal.z())},
+          float(hit_record.m_u),
+          float(hit_record.m_v),
+          index | (hit_record.m_front_face ? PrimaryHit::front_face_flag : 0)};
+    }
+
+    const std::uint32_t index =
+        primary_hit.m_primitive & ~PrimaryHit::front_face_flag;
+    if (index == PrimaryHit::missed) {
+      return background(ray);
+    }
+    if (index >= m_primitive_table->size()) {
+      return ray_color(ray, m_max_depth, world);
+    }
+
+    HitRecord hit_record;
+    hit_record.m_t = primary_hit.m_t;
+    hit_record.m_point = ray.at(primary_hit.m_t);
+    hit_record.m_normal = Vec3(primary_hit.m_normal[0],
+                               primary_hit.m_normal[1],
+                               primary_hit.m_normal[2]);
+    hit_record.m_u = primary_hit.m_u;
+    hit_record.m_v = primary_hit.m_v;
+    hit_record.m_front_face =
+        (primary_hit.m_primitive & PrimaryHit::front_face_flag) != 0;
+    hit_record.m_primitive = &m_primitive_table->primitive(index);
+    hit_record.m_material = hit_record.m_primitive->material();
+    return shade(ray, hit_record, m_max_depth, world);
+  }
+
+  // What, besides the camera, changes what a progressive sample adds to a
+  // pixel: the render mode and the lights sampled at each hit. Progressive
+  // passes never sort their rays, so --sort-rays is left out.
+  std::uint64_t integrator_hash() const {
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    hash = hash_combine(hash, double(m_render_mode));
+    hash = hash_combine(hash, double(m_lights.lights().size()));
+    for (const auto &light : m_lights.lights()) {
+      hash = RandomGenerator::mix_bits(hash ^ light->geometry_hash());
+    }
+    return hash;
+  }
+
+  std::uint64_t checkpoint_hash(const ProgressiveSettings &settings) const {
+    return RandomGenerator::mix_bits(
+        configuration_hash() ^ RandomGenerator::mix_bits(integrator_hash()) ^
+        settings.m_scene_hash);
+  }
+
+  Checkpoint make_checkpoint(const ProgressiveSettings &settings) const {
+    return Checkpoint{checkpoint_hash(settings), m_sample_seed, m_image_width,
+                      m_image_height, m_row_samples, m_accumulation};
+  }
+
+  void resume_from_checkpoint(const ProgressiveSettings &settings) {
+    Checkpoint expected;
+    expected.m_configuration_hash = checkpoint_hash(settings);
+    expected.m_width = m_image_width;
+    expected.m_height = m_image_height;
+
+    Checkpoint checkpoint;
+    if (!read_checkpoint(settings.m_checkpoint_path, expected, checkpoint)) {
+      std::clog << "No checkpoint for this scene and camera at "
+                << settings.m_checkpoint_path << ", starting from scratch"
+                << std::endl;
+      return;
+    }
+
+    m_sample_seed = checkpoint.m_sample_seed;
+    m_row_samples = std::move(checkpoint.m_row_samples);
+    m_accumulation = std::move(checkpoint.m_accumulation);
+    std::clog << "Resuming from " << settings.m_checkpoint_path << " at "
+              << *std::min_element(std::begin(m_row_samples),
+                                   std::end(m_row_samples))
+              << " spp" << std::endl;
+  }
+
+  FloatImage resolved_accumulation() const {
+    FloatImage image{m_image_width, m_image_height, m_accumulation};
+    for (unsigned int row = 0; row < m_image_height; ++row) {
+      const double scale =
+          m_row_samples[row] > 0 ? 1.0 / m_row_samples[row] : 0.0;
+      for (unsigned int column = 0; column < m_image_width; ++column) {
+        image.m_pixels[row * m_image_width + column] *= scale;
+      }
+    }
+    return image;
+  }
+
+  void resolve_accumulation() {
+    m_image_matrix = resolved_accumulation().m_pixels;
+  }
+
+  // Copies the accumulation buffer while the pool is between passes, the
+  // formatting and disk I/O happen on a separate thread
+  std::future<void> write_snapshot(const std::string &path) const {
+    return std::async(std::launch::async,
+                      [image = resolved_accumulation(), path] {
+                        const TraceScope trace("write_snapshot", "output");
+                        const std::string temporary_path = path + ".tmp";
+                        {
+                          std::ofstream out(temporary_path);
+                          write_ppm(out, image);
+                        }
+                        std::error_code error;
+                        std::filesystem::rename(temporary_path, path, error);
+                      });
+  }
+
   Ray get_ray(const int i, const int j) const {
     const auto offset = sample_square();
     const auto pixel_sample = m_pixel00_loc +
@@ -112,27 +1002,102 @@ private:
     return Vec3(random_double() - 0.5, random_double() - 0.5, 0);
   }
 
+  // bsdf_pdf is the density with which the previous bounce picked this ray
+  // if it also sampled the lights, otherwise zero. Emitters found this way
+  // are then weighted against light sampling finding them.
   Color ray_color(const Ray &ray, const unsigned int depth,
-                  const Hittable &world) const {
+                  const Hittable &world, const double bsdf_pdf = 0.0) const {
     if (depth == 0) {
       return Color(0, 0, 0);
     }
     HitRecord hit_record;
 
     if (world.hit(ray, Interval(0.001, infinity), hit_record)) {
-      Ray scattered;
-      Color attenuation;
-      if (hit_record.m_material->scatter(ray, hit_record, attenuation,
-                                         scattered)) {
-        return attenuation * ray_color(scattered, depth - 1, world);
-      }
-      return Color(0, 0, 0);
+      return shade(ray, hit_record, depth, world, bsdf_pdf);
     }
+    return background(ray);
+  }
+
+  // The rest of ray_color once the ray has hit something
+  Color shade(const Ray &ray, const HitRecord &hit_record,
+              const unsigned int depth, const Hittable &world,
+              const double bsdf_pdf = 0.0) const {
+    const Material &material = *hit_record.m_material;
+    Color radiance = material.emitted(hit_record);
+    // Only the listed lights are also reached by light sampling, the others
+    // keep their full emission
+    if (bsdf_pdf > 0.0 && !radiance.near_zero() &&
+        m_lights.contains(hit_record.m_primitive)) {
+      const double light_pdf =
+          m_lights.pdf_value(ray.origin(), ray.direction(), ray.time());
+      radiance = radiance * power_heuristic(bsdf_pdf, light_pdf);
+    }
+
+    BsdfSample bsdf_sample;
+    if (!material.sample(ray, hit_record, bsdf_sample)) {
+      return radiance;
+    }
+
+    // Specular lobes can't be light sampled and keep the full emission
+    double next_bsdf_pdf = 0.0;
+    if (!bsdf_sample.m_is_specular && !m_lights.empty()) {
+      radiance += direct_lighting(ray, hit_record, world);
+      next_bsdf_pdf = bsdf_sample.m_pdf;
+    }
+
+    const Ray scattered(hit_record.m_point, bsdf_sample.m_direction,
+                        ray.time());
+    return radiance + bsdf_sample.m_weight *
+                          ray_color(scattered, depth - 1, world, next_bsdf_pdf);
+  }
+
+  static Color background(const Ray &ray) {
     const Vec3 unit_direction = unit_vector(ray.direction());
     const auto alpha = 0.5 * (unit_direction.y() + 1.0);
     return (1.0 - alpha) * Color(1.0, 1.0, 1.0) + alpha * Color(0.5, 0.7, 1.0);
   }
 
+  // One shadow ray towards a sampled light, weighted against the BSDF
+  // sample of the same bounce finding that light
+  Color direct_lighting(const Ray &ray, const HitRecord &hit_record,
+                        const Hittable &world) const {
+    const Vec3 direction =
+        m_lights.random_direction(hit_record.m_point, ray.time());
+    const double cosine =
+        dot(direction, hit_record.m_normal) / direction.length();
+    if (cosine <= 0.0) {
+      return Color(0, 0, 0);
+    }
+    const double light_pdf =
+        m_lights.pdf_value(hit_record.m_point, direction, ray.time());
+    if (light_pdf <= 0.0) {
+      return Color(0, 0, 0);
+    }
+    const Material &material = *hit_record.m_material;
+    const Color bsdf = material.eval(ray, hit_record, direction);
+    if (bsdf.near_zero()) {
+      return Color(0, 0, 0);
+    }
+
+    // Find the light first, then only ask whether anything is in between
+    const Ray shadow_ray(hit_record.m_point, direction, ray.time());
+    HitRecord light_record;
+    if (!m_lights.hit(shadow_ray, Interval(0.001, infinity), light_record) ||
+        world.occluded(shadow_ray,
+                       Interval(0.001, light_record.m_t * (1 - 1e-6)))) {
+      return Color(0, 0, 0);
+    }
+    const double bsdf_pdf = material.pdf(ray, hit_record, direction);
+    return bsdf * light_record.m_material->emitted(light_record) *
+           (cosine / light_pdf * power_heuristic(light_pdf, bsdf_pdf));
+  }
+
+  // Veach's power heuristic with an exponent of two
+  static double power_heuristic(const double pdf, const double other_pdf) {
+    const double pdf_squared = pdf * pdf;
+    return pdf_squared / (pdf_squared + other_pdf * other_pdf);
+  }
+
 private:
   Point3 calc_pixel00_loc() const {
     const auto viewport_upper_left =
@@ -166,6 +1131,8 @@ private:
   const unsigned int m_image_height;
   std::vector<Color> m_image_matrix;
   const Point3 m_camera_position;
+  const Point3 m_looking_at;
+  const Vec3 m_up_direction;
   const double m_defocus_angle;
   const double m_focus_dist;
   const std::array<Vec3, 3> m_frame_basis;
@@ -181,5 +1148,24 @@ private:
   const unsigned int m_samples_per_pixel;
   const double m_pixel_samples_scale;
   const unsigned int m_max_depth;
-  std::unique_ptr<ThreadPool> m_thread_pool;
+  std::shared_ptr<ThreadPool> m_thread_pool;
+  RenderMode m_render_mode = RenderMode::Shaded;
+  bool m_keep_threads_alive = false;
+  // Per pixel sums of the progressive passes and the sample count of each row
+  std::vector<Color> m_accumulation;
+  std::vector<unsigned int> m_row_samples;
+  std::uint64_t m_sample_seed = 0;
+  LightList m_lights;
+  bool m_render_auxiliary = false;
+  bool m_denoise = false;
+  bool m_sort_rays = false;
+  AuxiliaryBuffers m_auxiliary;
+  std::shared_ptr<PrimaryHitBuffer> m_primary_hits;
+  // Built by every render that uses the buffer, the world may have changed
+  std::unique_ptr<PrimitiveTable> m_primitive_table;
+  PrimaryHitMode m_primary_hit_mode = PrimaryHitMode::Off;
+  // Sum and sum of squares of every pixel's sample luminance, and the
+  // number of samples in them for each row, only kept for denoising
+  std::vector<std::array<double, 2>> m_luminance_moments;
+  std::vector<unsigned int> m_row_moment_samples;
 };
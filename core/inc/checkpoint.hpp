@@ -0,0 +1,30 @@
+#pragma once
+
+#include <color.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Everything needed to continue a progressive render: the per pixel sums,
+// how many samples each row has taken, and the seed the sample streams are
+// derived from. The configuration hash ties it to one scene and camera.
+struct Checkpoint {
+  std::uint64_t m_configuration_hash = 0;
+  std::uint64_t m_sample_seed = 0;
+  unsigned int m_width = 0;
+  unsigned int m_height = 0;
+  std::vector<unsigned int> m_row_samples;
+  std::vector<Color> m_accumulation;
+};
+
+// Writes to a temporary file and renames it over the path, so a crash while
+// writing never leaves a truncated checkpoint behind. Return false on failure.
+bool write_checkpoint(const std::string &path, const Checkpoint &checkpoint);
+
+// Only reads the sums if the file's configuration hash and size are those
+// of the expected checkpoint and the file holds exactly that many rows and
+// pixels, so a stale or corrupt file costs no more than its header.
+// Returns false and leaves the checkpoint empty otherwise.
+bool read_checkpoint(const std::string &path, const Checkpoint &expected,
+                     Checkpoint &checkpoint);
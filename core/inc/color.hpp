@@ -8,3 +8,11 @@
 using Color = Vec3;
 
 void write_color(std::ostream &, const Color &);
+
+// Maps [0, 1] onto a blue, cyan, green, yellow, red ramp, in display space
+Color false_color(double value);
+
+// Rec. 709 luminance of a linear colour
+inline double luminance(const Color &color) {
+  return 0.2126 * color.x() + 0.7152 * color.y() + 0.0722 * color.z();
+}
@@ -0,0 +1,395 @@
+#pragma once
+
+#include <aabb.hpp>
+#include <bvh.hpp>
+#include <bvh_common.hpp>
+#include <hittable.hpp>
+#include <hittable_list.hpp>
+#include <interval.hpp>
+#include <ray.hpp>
+#include <ray_query.hpp>
+#include <traversal_stats.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// The same tree as BasicBoundedVolumeHierarchy, stored in a cache line per
+// node. A node holds the boxes of its two children, at time 0 and 1, in
+// 8 bit steps across its own box. The steps are rounded outwards, so the
+// boxes only ever grow and rays never miss what they should hit. Leaves
+// with a single primitive are folded into their parent, which then points
+// at the primitive directly. Compressed trees can't be refit, build a new
+// one when the primitives move.
+template <typename... t_Primitives>
+class BasicCompressedBoundedVolumeHierarchy : public Hittable {
+public:
+  using t_Hierarchy = BasicBoundedVolumeHierarchy<t_Primitives...>;
+
+  BasicCompressedBoundedVolumeHierarchy(HittableList hittable_list)
+      : BasicCompressedBoundedVolumeHierarchy(t_Hierarchy(hittable_list)) {}
+
+  // Sorts objects in [start, end) along the way
+  BasicCompressedBoundedVolumeHierarchy(
+      std::vector<std::shared_ptr<Hittable>> &objects, const size_t start,
+      const size_t end)
+      : BasicCompressedBoundedVolumeHierarchy(
+            t_Hierarchy(objects, start, end)) {}
+
+  // Takes over the primitives of a full precision tree and compresses its
+  // nodes
+  explicit BasicCompressedBoundedVolumeHierarchy(t_Hierarchy &&hierarchy)
+      : m_bounding_box(hierarchy.bounding_box())
+      , m_motion_bounds(hierarchy.motion_bounds())
+      , m_primitives(std::move(hierarchy.m_primitives))
+      , m_unbounded_objects(std::move(hierarchy.m_unbounded_objects))
+      , m_owned_objects(std::move(hierarchy.m_owned_objects)) {
+    if (!hierarchy.m_nodes.empty()) {
+      m_nodes.reserve(hierarchy.m_nodes.size());
+      m_is_root_moving = hierarchy.m_nodes.front().m_is_moving;
+      m_root_bounds = hierarchy.m_nodes.front().m_motion_bounds;
+      compress(hierarchy, hierarchy.m_nodes.front());
+    }
+  }
+
+  bool hit(const Ray &ray, Interval ray_t,
+           HitRecord &hit_record) const override {
+    const RayQuery query(ray);
+    bool hit_anything = false;
+    for (const auto *object : m_unbounded_objects) {
+      if (object->hit(query, ray_t, hit_record)) {
+        hit_anything = true;
+        ray_t.m_max = hit_record.m_t;
+      }
+    }
+
+    BvhNodeStack stack;
+    if (!m_nodes.empty() && root_hit(query, ray_t)) {
+      stack.push(0);
+    }
+    while (!stack.empty()) {
+      RT_COUNT_NODE_VISIT();
+      const Node &node = m_nodes[stack.pop()];
+      const NodeFrame frame = node_frame(node, query);
+
+      // The right child goes on the stack first, so the left one is
+      // searched first
+      for (unsigned int side = node.m_num_children; side-- > 0;) {
+        if (!child_hit(node, frame, side, query, ray_t)) {
+          continue;
+        }
+        const std::uint32_t child = node.m_children[side];
+        if (kind(child) == node_kind) {
+          stack.push(index(child));
+        } else if (visit_primitive(child, [&](const auto &primitive) {
+                     return primitive.hit(query, ray_t, hit_record);
+                   })) {
+          hit_anything = true;
+          ray_t.m_max = hit_record.m_t;
+        }
+      }
+    }
+    return hit_anything;
+  }
+
+  bool occluded(const Ray &ray, const Interval ray_t) const override {
+    const RayQuery query(ray);
+    for (const auto *object : m_unbounded_objects) {
+      if (object->occluded(query, ray_t)) {
+        return true;
+      }
+    }
+
+    BvhNodeStack stack;
+    if (!m_nodes.empty() && root_hit(query, ray_t)) {
+      stack.push(0);
+    }
+    while (!stack.empty()) {
+      RT_COUNT_NODE_VISIT();
+      const Node &node = m_nodes[stack.pop()];
+      const NodeFrame frame = node_frame(node, query);
+
+      for (unsigned int side = node.m_num_children; side-- > 0;) {
+        if (!child_hit(node, frame, side, query, ray_t)) {
+          continue;
+        }
+        const std::uint32_t child = node.m_children[side];
+        if (kind(child) == node_kind) {
+          stack.push(index(child));
+        } else if (visit_primitive(child, [&](const auto &primitive) {
+                     return primitive.occluded(query, ray_t);
+                   })) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  AxisAlignedBoundingBox bounding_box() const override {
+    return m_bounding_box;
+  }
+
+  std::array<AxisAlignedBoundingBox, 2> motion_bounds() const override {
+    return m_motion_bounds;
+  }
+
+  void
+  collect_primitives(std::vector<const Hittable *> &primitives) const override {
+    for (const auto &object : m_owned_objects) {
+      object->collect_primitives(primitives);
+    }
+  }
+
+  size_t num_nodes() const { return m_nodes.size(); }
+
+  // Heap memory of the tree itself, the objects it points at not included
+  size_t memory_bytes() const {
+    return m_nodes.capacity() * sizeof(Node) + m_primitives.memory_bytes() +
+           m_unbounded_objects.capacity() * sizeof(const Hittable *) +
+           m_owned_objects.capacity() * sizeof(std::shared_ptr<Hittable>);
+  }
+
+private:
+  // A child is a node or one of the primitives. The kind goes in the top
+  // bits, the index in the rest.
+  static constexpr unsigned int kind_shift = 29;
+  static constexpr std::uint32_t index_mask = (1u << kind_shift) - 1;
+  static constexpr std::uint32_t node_kind = 0;
+  static_assert(BvhPrimitives<t_Primitives...>::other_kind <
+                    (1u << (32 - kind_shift)),
+                "Too many primitive types for the child encoding");
+
+  static std::uint32_t kind(const std::uint32_t child) {
+    return child >> kind_shift;
+  }
+  static std::uint32_t index(const std::uint32_t child) {
+    return child & index_mask;
+  }
+
+  // Quantized box, the low corner and then the high one
+  using t_QuantizedBox = std::array<std::uint8_t, 6>;
+
+  struct alignas(64) Node {
+    // The node's own box starts at m_origin and spans 255 steps of m_step
+    std::array<float, 3> m_origin;
+    std::array<float, 3> m_step;
+    // Each child's box at time 0 and time 1
+    std::array<std::array<t_QuantizedBox, 2>, 2> m_child_bounds;
+    std::array<std::uint32_t, 2> m_children;
+    // One for a leaf that was the whole tree and held a single primitive
+    std::uint8_t m_num_children;
+    // Bit per child, only moving children blend their boxes to the ray's
+    // time
+    std::uint8_t m_moving_children;
+  };
+  static_assert(sizeof(Node) == 64, "A node should fill one cache line");
+
+  using t_SourceNode = typename t_Hierarchy::Node;
+  using t_SourceChild = typename t_Hierarchy::ChildReference;
+
+  // Appends node and the nodes under it in depth first order, returns its
+  // index. The primitives have already been taken over, with their indices.
+  std::uint32_t compress(const t_Hierarchy &hierarchy,
+                         const t_SourceNode &source) {
+    const auto node_index = std::uint32_t(m_nodes.size());
+    m_nodes.emplace_back();
+
+    std::array<std::uint32_t, 2> children;
+    std::array<std::array<AxisAlignedBoundingBox, 2>, 2> child_bounds;
+    unsigned int num_children = 2;
+    if (source.m_num_primitives == 0) {
+      for (unsigned int side = 0; side < 2; ++side) {
+        const t_SourceNode &child =
+            hierarchy.m_nodes[source.m_children[side].m_index];
+        child_bounds[side] = child.m_motion_bounds;
+        children[side] = child.m_num_primitives == 1
+                             ? encode(child.m_children[0])
+                             : encode(node_kind, compress(hierarchy, child));
+      }
+    } else {
+      num_children = source.m_num_primitives;
+      for (unsigned int side = 0; side < 2; ++side) {
+        children[side] = encode(source.m_children[side]);
+        child_bounds[side] = visit_primitive(
+            children[side],
+            [](const auto &primitive) { return primitive.motion_bounds(); });
+      }
+    }
+
+    auto &node = m_nodes[node_index];
+    node.m_children = children;
+    node.m_num_children = std::uint8_t(num_children);
+    node.m_moving_children = 0;
+    for (unsigned int side = 0; side < 2; ++side) {
+      if (!(child_bounds[side][0] == child_bounds[side][1])) {
+        node.m_moving_children |= std::uint8_t(1 << side);
+      }
+    }
+    quantize(node, child_bounds);
+    return node_index;
+  }
+
+  static std::uint32_t encode(const std::uint32_t kind,
+                              const std::uint32_t index) {
+    return (kind << kind_shift) | index;
+  }
+
+  // The full precision tree uses the same kinds
+  static std::uint32_t encode(const t_SourceChild child) {
+    return encode(child.m_kind, child.m_index);
+  }
+
+  static double dequantize(const float origin, const float step,
+                           const std::uint8_t value) {
+    return double(origin) + value * double(step);
+  }
+
+  static void
+  quantize(Node &node,
+           const std::array<std::array<AxisAlignedBoundingBox, 2>, 2> &bounds) {
+    for (int axis = 0; axis < 3; ++axis) {
+      double low = infinity;
+      double high = -infinity;
+      for (const auto &child : bounds) {
+        for (const auto &box : child) {
+          low = std::min(low, box.axis_interval(axis).m_min);
+          high = std::max(high, box.axis_interval(axis).m_max);
+        }
+      }
+
+      // Round the origin down and the step up until 255 steps reach past
+      // the high end
+      float origin = float(low);
+      if (double(origin) > low) {
+        origin = std::nextafter(origin, -std::numeric_limits<float>::max());
+      }
+      float step = float((high - double(origin)) / 255);
+      while (dequantize(origin, step, 255) < high) {
+        step = std::nextafter(step, std::numeric_limits<float>::max());
+      }
+      node.m_origin[axis] = origin;
+      node.m_step[axis] = step;
+
+      for (unsigned int side = 0; side < 2; ++side) {
+        for (unsigned int time = 0; time < 2; ++time) {
+          const Interval &interval = bounds[side][time].axis_interval(axis);
+          auto &box = node.m_child_bounds[side][time];
+          box[axis] = quantize_down(origin, step, interval.m_min);
+          box[axis + 3] = quantize_up(origin, step, interval.m_max);
+        }
+      }
+    }
+  }
+
+  // The largest value that dequantizes to at most value
+  static std::uint8_t quantize_down(const float origin, const float step,
+                                    const double value) {
+    if (step == 0.0f) {
+      return 0;
+    }
+    int quantized = std::clamp(
+        int(std::floor((value - double(origin)) / double(step))), 0, 255);
+    while (quantized > 0 &&
+           dequantize(origin, step, std::uint8_t(quantized)) > value) {
+      --quantized;
+    }
+    return std::uint8_t(quantized);
+  }
+
+  // The smallest value that dequantizes to at least value
+  static std::uint8_t quantize_up(const float origin, const float step,
+                                  const double value) {
+    if (step == 0.0f) {
+      return 0;
+    }
+    int quantized = std::clamp(
+        int(std::ceil((value - double(origin)) / double(step))), 0, 255);
+    while (quantized < 255 &&
+           dequantize(origin, step, std::uint8_t(quantized)) < value) {
+      ++quantized;
+    }
+    return std::uint8_t(quantized);
+  }
+
+  // A node's grid in terms of the ray's distance, plane q of an axis lies
+  // at m_base + q * m_scale along the ray. Along axes the ray runs parallel
+  // to these are infinite or NaN, the slab test then ignores that axis,
+  // which can only keep children it could have culled.
+  struct NodeFrame {
+    std::array<double, 3> m_base;
+    std::array<double, 3> m_scale;
+  };
+
+  static NodeFrame node_frame(const Node &node, const RayQuery &query) {
+    NodeFrame frame;
+    for (int axis = 0; axis < 3; ++axis) {
+      const double inverse = query.inverse_direction()[axis];
+      frame.m_base[axis] =
+          (double(node.m_origin[axis]) - query.origin()[axis]) * inverse;
+      frame.m_scale[axis] = double(node.m_step[axis]) * inverse;
+    }
+    return frame;
+  }
+
+  // The slab test of the full precision boxes, one multiply-add per plane
+  // instead of decoding the box first. Moving children blend their planes
+  // to the ray's time, like the nodes of the full precision tree.
+  static bool child_hit(const Node &node, const NodeFrame &frame,
+                        const unsigned int side, const RayQuery &query,
+                        Interval ray_t) {
+    RT_COUNT_BOX_TEST();
+
+    const auto &bounds = node.m_child_bounds[side];
+    const bool is_moving = node.m_moving_children & (1 << side);
+    const double time = query.time();
+    const auto plane = [&](const int index) {
+      const double start = bounds[0][index];
+      return is_moving ? start + time * (bounds[1][index] - start) : start;
+    };
+
+    for (int axis = 0; axis < 3; ++axis) {
+      const bool is_negative = query.direction_is_negative(axis);
+      const double near = plane(is_negative ? axis + 3 : axis);
+      const double far = plane(is_negative ? axis : axis + 3);
+
+      const double t_near = frame.m_base[axis] + near * frame.m_scale[axis];
+      const double t_far = frame.m_base[axis] + far * frame.m_scale[axis];
+      ray_t.m_min = t_near > ray_t.m_min ? t_near : ray_t.m_min;
+      ray_t.m_max = t_far < ray_t.m_max ? t_far : ray_t.m_max;
+    }
+    return ray_t.m_min < ray_t.m_max;
+  }
+
+  // The root's box is kept at full precision, there is no parent to hold it
+  bool root_hit(const RayQuery &query, const Interval ray_t) const {
+    return bvh_bounds_hit(m_is_root_moving, m_root_bounds, m_root_bounds[0],
+                          query, ray_t);
+  }
+
+  // Calls function with the child primitive as its concrete type
+  template <typename t_Function>
+  auto visit_primitive(const std::uint32_t child,
+                       const t_Function &function) const {
+    return m_primitives.visit(kind(child), index(child), function);
+  }
+
+private:
+  std::vector<Node> m_nodes;
+  AxisAlignedBoundingBox m_bounding_box;
+  std::array<AxisAlignedBoundingBox, 2> m_motion_bounds;
+  bool m_is_root_moving = false;
+  std::array<AxisAlignedBoundingBox, 2> m_root_bounds;
+  BvhPrimitives<t_Primitives...> m_primitives;
+  std::vector<const Hittable *> m_unbounded_objects;
+  // Keeps everything the tree points at alive
+  std::vector<std::shared_ptr<Hittable>> m_owned_objects;
+};
+
+// A compressed BoundedVolumeHierarchy
+using CompressedBoundedVolumeHierarchy =
+    BasicCompressedBoundedVolumeHierarchy<Sphere, Quad>;
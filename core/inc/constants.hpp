@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <limits>
 #include <random>
 
@@ -12,18 +14,74 @@ inline double degrees_to_radians(const double degrees) {
   return degrees * pi / 180.0;
 }
 
+// SplitMix64, small and fast with a state that is a single integer, so
+// reseeding it for every sample costs nothing
+class RandomGenerator {
+public:
+  using result_type = std::uint64_t;
+
+  explicit RandomGenerator(const std::uint64_t seed)
+      : m_state(seed) {}
+
+  void seed(const std::uint64_t seed) { m_state = seed; }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  result_type operator()() {
+    m_state += 0x9e3779b97f4a7c15ull;
+    return mix_bits(m_state);
+  }
+
+  // Finalizer that spreads every input bit over the whole output
+  static std::uint64_t mix_bits(std::uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+  }
+
+private:
+  std::uint64_t m_state;
+};
+
+// Folds value into a running hash, bit for bit
+inline std::uint64_t hash_combine(const std::uint64_t hash,
+                                  const double value) {
+  std::uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return RandomGenerator::mix_bits(hash ^ bits);
+}
+
+// Per-thread generator shared by all of the random helpers below
+inline RandomGenerator &random_generator() {
+  thread_local RandomGenerator generator(
+      (std::uint64_t(std::random_device{}()) << 32) | std::random_device{}());
+  return generator;
+}
+
+inline std::normal_distribution<double> &gaussian_distribution() {
+  // The distribution caches its second sample, so it can't be shared
+  thread_local std::normal_distribution<double> distribution(0.0, 1.0);
+  return distribution;
+}
+
+// Make the calling thread's random sequence reproducible
+inline void seed_random_generator(const std::uint64_t seed) {
+  random_generator().seed(seed);
+  gaussian_distribution().reset();
+}
+
 // Random double in [0.0, 1.0)
 inline double random_double() {
-  static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-  thread_local std::mt19937 generator(std::random_device{}());
-  return distribution(generator);
+  // The top 53 bits fill the mantissa exactly
+  return (random_generator()() >> 11) * 0x1.0p-53;
 }
 
 // Random gaussian sample with mean 0 and stddev 1
 inline double random_gaussian_double() {
-  static std::normal_distribution<double> distribution(0.0, 1.0);
-  thread_local std::mt19937 generator(std::random_device{}());
-  return distribution(generator);
+  return gaussian_distribution()(random_generator());
 }
 
 // Random double in [min, max)
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <image.hpp>
+#include <thread_pool.hpp>
+
+#include <string>
+#include <vector>
+
+// What the primary rays hit, averaged over a few rays per pixel
+struct AuxiliaryBuffers {
+  FloatImage m_albedo;
+  // Facing the camera, zero where every ray missed
+  FloatImage m_normal;
+  // Distance to the first hit, zero for misses
+  std::vector<double> m_depth;
+  // Variance of each pixel's mean luminance, estimated from its samples. The
+  // filter backs off where this is low, so it fades out as samples are added.
+  std::vector<double> m_variance;
+};
+
+struct DenoiseSettings {
+  // Each iteration doubles the filter's reach, three cover 29 pixels. More
+  // remove more noise but blur the detail that the guides can't see.
+  unsigned int m_iterations = 3;
+  // Edge stopping, smaller values preserve more edges and remove less noise.
+  // Luminance differences are measured in standard deviations of the noise.
+  double m_luminance_sigma = 2;
+  double m_normal_exponent = 32;
+  double m_depth_sigma = 0.05;
+};
+
+// Edge-avoiding à-trous wavelet filter, guided by the variance like SVGF.
+// The illumination is filtered with the albedo divided out and multiplied
+// back afterwards, so texture detail is kept sharp. Rows are filtered in
+// parallel on the pool, which has to be running.
+FloatImage denoise(const FloatImage &color, const AuxiliaryBuffers &auxiliary,
+                   const DenoiseSettings &settings, ThreadPool &thread_pool);
+
+// Writes PREFIX_albedo.pfm, PREFIX_normal.pfm and PREFIX_depth.pfm
+bool write_auxiliary_buffers(const std::string &prefix,
+                             const AuxiliaryBuffers &auxiliary);
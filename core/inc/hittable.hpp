@@ -1,11 +1,17 @@
 #pragma once
 
 #include <aabb.hpp>
+#include <constants.hpp>
 #include <interval.hpp>
 #include <ray.hpp>
+#include <ray_query.hpp>
 
+#include <array>
+#include <cstdint>
 #include <memory>
+#include <vector>
 
+class Hittable;
 class Material;
 
 struct HitRecord {
@@ -15,7 +21,11 @@ struct HitRecord {
   double m_u;
   double m_v;
   bool m_front_face;
-  std::shared_ptr<Material> m_material;
+  // Owned by the primitive, a plain pointer keeps reference counting out of
+  // every intersection test
+  const Material *m_material;
+  // The primitive that was hit, not any container around it
+  const Hittable *m_primitive;
 
   void set_face_normal(const Ray &ray, const Vec3 &outward_normal) {
     // Assumes outward_normal has unit length
@@ -32,4 +42,66 @@ struct Hittable {
                    HitRecord &hit_record) const = 0;
 
   virtual AxisAlignedBoundingBox bounding_box() const = 0;
+
+  // For callers that already have a RayQuery, such as the BVH. Primitives
+  // that make use of its precomputed data provide their own.
+  bool hit(const RayQuery &query, Interval ray_t,
+           HitRecord &hit_record) const {
+    return hit(query.ray(), ray_t, hit_record);
+  }
+
+  bool occluded(const RayQuery &query, Interval ray_t) const {
+    return occluded(query.ray(), ray_t);
+  }
+
+  // Any-hit query for shadow rays, true as soon as anything is found in
+  // ray_t. Overrides skip the search for the closest hit and never fill in
+  // normals or materials.
+  virtual bool occluded(const Ray &ray, Interval ray_t) const {
+    HitRecord hit_record;
+    return hit(ray, ray_t, hit_record);
+  }
+
+  // Bounds at time 0 and time 1, for primitives whose bounds at any time in
+  // between are contained by the linear blend of the two. The default of
+  // the whole bounding box at both ends is always valid.
+  virtual std::array<AxisAlignedBoundingBox, 2> motion_bounds() const {
+    const auto box = bounding_box();
+    return {box, box};
+  }
+
+  // Light sampling, only needed by primitives that are put in a LightList.
+  // random_direction picks a direction from origin towards the primitive
+  // and pdf_value is the solid angle density of picking direction.
+  virtual double pdf_value(const Point3 &, const Vec3 &, double) const {
+    return 0.0;
+  }
+
+  virtual Vec3 random_direction(const Point3 &, double) const {
+    return Vec3(1, 0, 0);
+  }
+
+  // Appends the primitives this is made of, in an order that only depends
+  // on how the scene was built. Containers list what they hold.
+  virtual void
+  collect_primitives(std::vector<const Hittable *> &primitives) const {
+    primitives.push_back(this);
+  }
+
+  // Changes whenever the shape or placement of the primitive does, and not
+  // with its material. The default goes by the motion bounds, primitives
+  // whose bounds don't pin them down provide their own.
+  virtual std::uint64_t geometry_hash() const {
+    std::uint64_t hash = 0;
+    for (const auto &box : motion_bounds()) {
+      for (int axis = 0; axis < 3; ++axis) {
+        hash = hash_combine(hash, box.axis_interval(axis).m_min);
+        hash = hash_combine(hash, box.axis_interval(axis).m_max);
+      }
+    }
+    return hash;
+  }
+
+  // What hits on this primitive are shaded with, null for containers
+  virtual const Material *material() const { return nullptr; }
 };
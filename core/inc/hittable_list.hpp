@@ -37,10 +37,26 @@ public:
     return hit_anything;
   }
 
+  bool occluded(const Ray &ray, Interval ray_t) const override {
+    for (const auto &object : m_objects) {
+      if (object->occluded(ray, ray_t)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   AxisAlignedBoundingBox bounding_box() const override {
     return m_bounding_box;
   }
 
+  void
+  collect_primitives(std::vector<const Hittable *> &primitives) const override {
+    for (const auto &object : m_objects) {
+      object->collect_primitives(primitives);
+    }
+  }
+
 public:
   std::vector<std::shared_ptr<Hittable>> m_objects;
 
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <color.hpp>
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Linear, unclamped floating point image, stored row major from the top left
+struct FloatImage {
+  unsigned int m_width = 0;
+  unsigned int m_height = 0;
+  std::vector<Color> m_pixels;
+};
+
+// Portable float map (.pfm) I/O, return false on any failure
+bool write_pfm(const std::string &path, const FloatImage &image);
+bool read_pfm(const std::string &path, FloatImage &image);
+
+// Plain text 8 bit PPM, after gamma correction
+void write_ppm(std::ostream &out, const FloatImage &image);
+
+// Both metrics throw std::invalid_argument for images of different sizes
+
+// Root mean squared error over every channel of every pixel
+double root_mean_squared_error(const FloatImage &image,
+                               const FloatImage &reference);
+
+// Mean of the squared error relative to the squared reference value, which
+// weights errors in dark regions as heavily as those in bright ones
+double relative_mean_squared_error(const FloatImage &image,
+                                   const FloatImage &reference);
@@ -4,19 +4,24 @@
 
 class Interval {
 public:
+  // The constructors are constexpr so that empty and universe are constant
+  // initialized, other translation units' statics are built from them
+
   // Default to empty
-  Interval()
+  constexpr Interval()
       : m_min(+infinity)
       , m_max(-infinity) {}
 
-  Interval(const double min, const double max)
+  constexpr Interval(const double min, const double max)
       : m_min(min)
       , m_max(max) {}
 
-  Interval(const Interval &a, const Interval &b)
+  constexpr Interval(const Interval &a, const Interval &b)
       : m_min((a.m_min <= b.m_min) ? a.m_min : b.m_min)
       , m_max((a.m_max >= b.m_max) ? a.m_max : b.m_max) {}
 
+  bool operator==(const Interval &) const = default;
+
   double size() const { return m_max - m_min; }
 
   bool contains(double x) const { return m_min <= x && x <= m_max; }
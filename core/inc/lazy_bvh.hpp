@@ -0,0 +1,317 @@
+#pragma once
+
+#include <aabb.hpp>
+#include <bvh.hpp>
+#include <bvh_common.hpp>
+#include <hittable.hpp>
+#include <hittable_list.hpp>
+#include <interval.hpp>
+#include <ray.hpp>
+#include <ray_query.hpp>
+#include <tracer.hpp>
+#include <traversal_stats.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// A bounding volume hierarchy that only builds what rays actually reach.
+// The top levels are split eagerly, down to ranges of at most
+// max_subtree_objects objects, and each range becomes a full hierarchy the
+// first time a ray enters its box. The splits are the same median splits
+// the eager tree makes, so once everything has been built the two trees
+// are alike. A ray that finds a subtree unbuilt builds it while rays
+// anywhere else keep going, only those that need the same subtree wait.
+template <typename... t_Primitives>
+class BasicLazyBoundedVolumeHierarchy : public Hittable {
+public:
+  using t_Hierarchy = BasicBoundedVolumeHierarchy<t_Primitives...>;
+
+  static constexpr size_t default_max_subtree_objects = 1024;
+
+  BasicLazyBoundedVolumeHierarchy(
+      const HittableList &hittable_list,
+      const size_t max_subtree_objects = default_max_subtree_objects)
+      : BasicLazyBoundedVolumeHierarchy(hittable_list.m_objects, 0,
+                                        hittable_list.m_objects.size(),
+                                        max_subtree_objects) {}
+
+  // Keeps its own copy of the objects in [start, end) for the subtrees
+  // that are yet to be built
+  BasicLazyBoundedVolumeHierarchy(
+      const std::vector<std::shared_ptr<Hittable>> &objects,
+      const size_t start, const size_t end,
+      const size_t max_subtree_objects = default_max_subtree_objects)
+      : m_max_subtree_objects(std::max<size_t>(max_subtree_objects, 1)) {
+    for (size_t index = start; index < end; ++index) {
+      if (objects[index]->bounding_box().is_bounded()) {
+        m_objects.push_back(objects[index]);
+      } else {
+        m_unbounded_objects.push_back(objects[index]);
+      }
+    }
+
+    if (!m_objects.empty()) {
+      const TraceScope trace("bvh.build_top", "scene", m_objects.size());
+      build(0, m_objects.size());
+    }
+  }
+
+  bool hit(const Ray &ray, Interval ray_t,
+           HitRecord &hit_record) const override {
+    const RayQuery query(ray);
+    bool hit_anything = false;
+    for (const auto &object : m_unbounded_objects) {
+      if (object->hit(query, ray_t, hit_record)) {
+        hit_anything = true;
+        ray_t.m_max = hit_record.m_t;
+      }
+    }
+
+    BvhNodeStack stack;
+    if (!m_nodes.empty()) {
+      stack.push(0);
+    }
+    while (!stack.empty()) {
+      RT_COUNT_NODE_VISIT();
+      const Node &node = m_nodes[stack.pop()];
+      if (!bvh_node_hit(node, query, ray_t)) {
+        continue;
+      }
+
+      if (!node.m_is_subtree) {
+        stack.push(node.m_children[1]);
+        stack.push(node.m_children[0]);
+        continue;
+      }
+      if (subtree(node.m_children[0]).hit(query, ray_t, hit_record)) {
+        hit_anything = true;
+        ray_t.m_max = hit_record.m_t;
+      }
+    }
+    return hit_anything;
+  }
+
+  bool occluded(const Ray &ray, const Interval ray_t) const override {
+    const RayQuery query(ray);
+    for (const auto &object : m_unbounded_objects) {
+      if (object->occluded(query, ray_t)) {
+        return true;
+      }
+    }
+
+    BvhNodeStack stack;
+    if (!m_nodes.empty()) {
+      stack.push(0);
+    }
+    while (!stack.empty()) {
+      RT_COUNT_NODE_VISIT();
+      const Node &node = m_nodes[stack.pop()];
+      if (!bvh_node_hit(node, query, ray_t)) {
+        continue;
+      }
+
+      if (!node.m_is_subtree) {
+        stack.push(node.m_children[1]);
+        stack.push(node.m_children[0]);
+        continue;
+      }
+      if (subtree(node.m_children[0]).occluded(query, ray_t)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  AxisAlignedBoundingBox bounding_box() const override {
+    if (!m_unbounded_objects.empty()) {
+      return AxisAlignedBoundingBox::universe;
+    }
+    return m_nodes.empty() ? AxisAlignedBoundingBox::empty
+                           : m_nodes.front().m_bounding_box;
+  }
+
+  std::array<AxisAlignedBoundingBox, 2> motion_bounds() const override {
+    if (!m_unbounded_objects.empty() || m_nodes.empty()) {
+      const auto box = bounding_box();
+      return {box, box};
+    }
+    return m_nodes.front().m_motion_bounds;
+  }
+
+  // Builds every subtree, the order of the objects in a range is only
+  // settled once it has been
+  void
+  collect_primitives(std::vector<const Hittable *> &primitives) const override {
+    for (size_t index = 0; index < m_subtrees.size(); ++index) {
+      subtree(std::uint32_t(index)).collect_primitives(primitives);
+    }
+    for (const auto &object : m_unbounded_objects) {
+      object->collect_primitives(primitives);
+    }
+  }
+
+  size_t num_subtrees() const { return m_subtrees.size(); }
+
+  size_t num_built_subtrees() const {
+    return m_num_built_subtrees.load(std::memory_order_relaxed);
+  }
+
+  // Share of the bounded objects whose subtree has been built so far
+  double built_fraction() const {
+    return m_objects.empty()
+               ? 1.0
+               : double(m_num_built_objects.load(std::memory_order_relaxed)) /
+                     m_objects.size();
+  }
+
+  // Heap memory of the tree as built so far, the objects it points at not
+  // included. Only meaningful while no rays are being traced.
+  size_t memory_bytes() const {
+    size_t bytes = m_nodes.capacity() * sizeof(Node) +
+                   m_subtrees.size() * sizeof(Subtree) +
+                   (m_objects.capacity() + m_unbounded_objects.capacity()) *
+                       sizeof(std::shared_ptr<Hittable>);
+    for (const auto &subtree : m_subtrees) {
+      if (const auto *hierarchy =
+              subtree.m_hierarchy.load(std::memory_order_acquire)) {
+        bytes += sizeof(t_Hierarchy) + hierarchy->memory_bytes();
+      }
+    }
+    return bytes;
+  }
+
+private:
+  struct Node {
+    AxisAlignedBoundingBox m_bounding_box;
+    // Bounds at time 0 and 1, blended to the ray's time during traversal
+    std::array<AxisAlignedBoundingBox, 2> m_motion_bounds;
+    bool m_is_moving;
+    // Subtree nodes hold the index of their subtree in the first child,
+    // inner nodes the indices of two other nodes
+    bool m_is_subtree;
+    std::array<std::uint32_t, 2> m_children;
+  };
+
+  // The objects in [m_start, m_end), built into m_hierarchy on first use
+  struct Subtree {
+    Subtree(const size_t start, const size_t end)
+        : m_start(start)
+        , m_end(end) {}
+
+    const size_t m_start;
+    const size_t m_end;
+    std::atomic<const t_Hierarchy *> m_hierarchy{nullptr};
+    std::mutex m_mutex;
+    std::unique_ptr<t_Hierarchy> m_owned_hierarchy;
+  };
+
+  std::uint32_t build(const size_t start, const size_t end) {
+    // The vector may grow while the children are built, so hold on to the
+    // index rather than a reference
+    const auto node_index = std::uint32_t(m_nodes.size());
+    m_nodes.emplace_back();
+
+    AxisAlignedBoundingBox bounding_box = AxisAlignedBoundingBox::empty;
+    for (size_t index = start; index < end; ++index) {
+      bounding_box = AxisAlignedBoundingBox(bounding_box,
+                                            m_objects[index]->bounding_box());
+    }
+
+    std::array<std::uint32_t, 2> children;
+    std::array<AxisAlignedBoundingBox, 2> motion_bounds;
+    const bool is_subtree = end - start <= m_max_subtree_objects;
+    if (is_subtree) {
+      children[0] = children[1] = std::uint32_t(m_subtrees.size());
+      m_subtrees.emplace_back(start, end);
+      motion_bounds = {AxisAlignedBoundingBox::empty,
+                       AxisAlignedBoundingBox::empty};
+      for (size_t index = start; index < end; ++index) {
+        const auto object_bounds = m_objects[index]->motion_bounds();
+        motion_bounds = {
+            AxisAlignedBoundingBox(motion_bounds[0], object_bounds[0]),
+            AxisAlignedBoundingBox(motion_bounds[1], object_bounds[1])};
+      }
+    } else {
+      // Only the split matters up here, not the order on either side of it,
+      // so the median is found without sorting the whole range
+      const int axis = bounding_box.longest_axis();
+      const auto midpoint = start + (end - start) / 2;
+      std::nth_element(std::begin(m_objects) + start,
+                       std::begin(m_objects) + midpoint,
+                       std::begin(m_objects) + end,
+                       [axis](const std::shared_ptr<Hittable> &a,
+                              const std::shared_ptr<Hittable> &b) {
+                         return a->bounding_box().axis_interval(axis).m_min <
+                                b->bounding_box().axis_interval(axis).m_min;
+                       });
+
+      children[0] = build(start, midpoint);
+      children[1] = build(midpoint, end);
+      const auto &left = m_nodes[children[0]].m_motion_bounds;
+      const auto &right = m_nodes[children[1]].m_motion_bounds;
+      motion_bounds = {AxisAlignedBoundingBox(left[0], right[0]),
+                       AxisAlignedBoundingBox(left[1], right[1])};
+    }
+
+    auto &node = m_nodes[node_index];
+    node.m_bounding_box = bounding_box;
+    node.m_motion_bounds = motion_bounds;
+    node.m_is_moving = !(motion_bounds[0] == motion_bounds[1]);
+    node.m_is_subtree = is_subtree;
+    node.m_children = children;
+    return node_index;
+  }
+
+  const t_Hierarchy &subtree(const std::uint32_t subtree_index) const {
+    auto &subtree = m_subtrees[subtree_index];
+    if (const auto *hierarchy =
+            subtree.m_hierarchy.load(std::memory_order_acquire)) {
+      return *hierarchy;
+    }
+    return build_subtree(subtree);
+  }
+
+  // The first ray to get here builds the subtree, others that arrive
+  // meanwhile wait for it on the subtree's own lock
+  const t_Hierarchy &build_subtree(Subtree &subtree) const {
+    const std::lock_guard<std::mutex> lock(subtree.m_mutex);
+    if (const auto *hierarchy =
+            subtree.m_hierarchy.load(std::memory_order_relaxed)) {
+      return *hierarchy;
+    }
+
+    const TraceScope trace("bvh.build_subtree", "scene",
+                           subtree.m_end - subtree.m_start);
+    // Subtrees sort disjoint ranges of the objects, so they can be built
+    // side by side
+    subtree.m_owned_hierarchy = std::make_unique<t_Hierarchy>(
+        m_objects, subtree.m_start, subtree.m_end);
+    m_num_built_objects.fetch_add(subtree.m_end - subtree.m_start,
+                                  std::memory_order_relaxed);
+    m_num_built_subtrees.fetch_add(1, std::memory_order_relaxed);
+    subtree.m_hierarchy.store(subtree.m_owned_hierarchy.get(),
+                              std::memory_order_release);
+    return *subtree.m_owned_hierarchy;
+  }
+
+private:
+  const size_t m_max_subtree_objects;
+  std::vector<Node> m_nodes;
+  // Built on first use by whichever ray gets there, hence mutable. The
+  // deque never moves the subtrees, which hold atomics and locks.
+  mutable std::deque<Subtree> m_subtrees;
+  mutable std::vector<std::shared_ptr<Hittable>> m_objects;
+  mutable std::atomic<size_t> m_num_built_objects{0};
+  mutable std::atomic<size_t> m_num_built_subtrees{0};
+  std::vector<std::shared_ptr<Hittable>> m_unbounded_objects;
+};
+
+// Built into BoundedVolumeHierarchy subtrees
+using LazyBoundedVolumeHierarchy =
+    BasicLazyBoundedVolumeHierarchy<Sphere, Quad>;
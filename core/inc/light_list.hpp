@@ -0,0 +1,69 @@
+#pragma once
+
+#include <hittable.hpp>
+#include <ray.hpp>
+#include <vec3.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// The emitters of a scene, sampled for direct lighting. Emitters left out
+// are still found by BSDF samples, just with more noise.
+class LightList {
+public:
+  void add(std::shared_ptr<Hittable> light) {
+    m_geometry_hashes.push_back(light->geometry_hash());
+    m_lights.push_back(light);
+  }
+
+  bool empty() const { return m_lights.empty(); }
+
+  const std::vector<std::shared_ptr<Hittable>> &lights() const {
+    return m_lights;
+  }
+
+  // Whether the primitive is one of the lights. Scenes build their light
+  // list apart from the world, so the world's copy of a light is matched
+  // by its shape and placement rather than by address.
+  bool contains(const Hittable *primitive) const {
+    return primitive != nullptr &&
+           std::find(std::begin(m_geometry_hashes),
+                     std::end(m_geometry_hashes),
+                     primitive->geometry_hash()) != std::end(m_geometry_hashes);
+  }
+
+  // Picks one light uniformly, then a direction towards it
+  Vec3 random_direction(const Point3 &origin, const double time) const {
+    const size_t index = std::min(size_t(random_double() * m_lights.size()),
+                                  m_lights.size() - 1);
+    return m_lights[index]->random_direction(origin, time);
+  }
+
+  // The closest light along the ray, without looking at anything else
+  bool hit(const Ray &ray, const Interval &ray_t, HitRecord &hit_record) const {
+    bool hit_anything = false;
+    double closest_so_far = ray_t.m_max;
+    for (const auto &light : m_lights) {
+      if (light->hit(ray, Interval(ray_t.m_min, closest_so_far), hit_record)) {
+        hit_anything = true;
+        closest_so_far = hit_record.m_t;
+      }
+    }
+    return hit_anything;
+  }
+
+  double pdf_value(const Point3 &origin, const Vec3 &direction,
+                   const double time) const {
+    double pdf = 0.0;
+    for (const auto &light : m_lights) {
+      pdf += light->pdf_value(origin, direction, time);
+    }
+    return pdf / m_lights.size();
+  }
+
+private:
+  std::vector<std::shared_ptr<Hittable>> m_lights;
+  std::vector<std::uint64_t> m_geometry_hashes;
+};
@@ -8,24 +8,66 @@
 #include <cmath>
 #include <memory>
 
+struct BsdfSample {
+  Vec3 m_direction;
+  // BSDF times cosine over pdf, what the path throughput is multiplied by
+  Color m_weight;
+  // Solid angle density of the direction, zero for specular lobes
+  double m_pdf;
+  // Specular lobes are a single direction that eval and pdf can't see and
+  // that light sampling can never hit
+  bool m_is_specular;
+};
+
 class Material {
 public:
   virtual ~Material() = default;
 
-  virtual bool scatter(const Ray &ray_in, const HitRecord &hit_record,
-                       Color &attenuation, Ray &scattered) const = 0;
+  // Draws an outgoing direction, false when the path ends here
+  virtual bool sample(const Ray &ray_in, const HitRecord &hit_record,
+                      BsdfSample &bsdf_sample) const = 0;
+
+  // The BSDF for light arriving from direction, without the cosine, and
+  // zero for specular lobes
+  virtual Color eval(const Ray &, const HitRecord &, const Vec3 &) const {
+    return Color(0, 0, 0);
+  }
+
+  // The density with which sample picks direction
+  virtual double pdf(const Ray &, const HitRecord &, const Vec3 &) const {
+    return 0.0;
+  }
+
+  virtual Color emitted(const HitRecord &) const { return Color(0, 0, 0); }
+
+  // Surface colour for the denoiser's albedo buffer
+  virtual Color albedo(const HitRecord &) const { return Color(1, 1, 1); }
+
+  // A sample as a ray and the weight to multiply its radiance by
+  bool scatter(const Ray &ray_in, const HitRecord &hit_record,
+               Color &attenuation, Ray &scattered) const {
+    BsdfSample bsdf_sample;
+    if (!sample(ray_in, hit_record, bsdf_sample)) {
+      return false;
+    }
+    attenuation = bsdf_sample.m_weight;
+    scattered = Ray(hit_record.m_point, bsdf_sample.m_direction, ray_in.time());
+    return true;
+  }
 };
 
 class Lambertian : public Material {
 public:
   Lambertian(const Color &albedo)
-      : m_texture(std::make_shared<SolidColor>(albedo)) {}
+      : m_texture(albedo) {}
 
   Lambertian(std::shared_ptr<Texture> texture)
-      : m_texture(texture) {}
+      : m_texture(*texture) {}
 
-  virtual bool scatter(const Ray &ray_in, const HitRecord &hit_record,
-                       Color &attenuation, Ray &scattered) const override {
+  // The normal plus a random unit vector is cosine distributed, so the
+  // weight is just the albedo
+  bool sample(const Ray &, const HitRecord &hit_record,
+              BsdfSample &bsdf_sample) const override {
     auto scatter_direction = hit_record.m_normal + random_unit_vector();
 
     // Catch degenerate scatter
@@ -33,14 +75,63 @@ public:
       scatter_direction = hit_record.m_normal;
     }
 
-    scattered = Ray(hit_record.m_point, scatter_direction, ray_in.time());
-    attenuation =
-        m_texture->value(hit_record.m_u, hit_record.m_v, hit_record.m_point);
+    bsdf_sample.m_direction = scatter_direction;
+    bsdf_sample.m_weight = albedo(hit_record);
+    bsdf_sample.m_pdf = cosine_pdf(hit_record, scatter_direction);
+    bsdf_sample.m_is_specular = false;
     return true;
   }
 
+  Color eval(const Ray &, const HitRecord &hit_record,
+             const Vec3 &direction) const override {
+    if (dot(direction, hit_record.m_normal) <= 0.0) {
+      return Color(0, 0, 0);
+    }
+    return albedo(hit_record) / pi;
+  }
+
+  double pdf(const Ray &, const HitRecord &hit_record,
+             const Vec3 &direction) const override {
+    return cosine_pdf(hit_record, direction);
+  }
+
+  Color albedo(const HitRecord &hit_record) const override {
+    return m_texture.value(hit_record.m_u, hit_record.m_v, hit_record.m_point);
+  }
+
 private:
-  std::shared_ptr<Texture> m_texture;
+
+  static double cosine_pdf(const HitRecord &hit_record, const Vec3 &direction) {
+    const double cosine =
+        dot(direction, hit_record.m_normal) / direction.length();
+    return cosine > 0.0 ? cosine / pi : 0.0;
+  }
+
+  CompiledTexture m_texture;
+};
+
+// Emits light from its front face and scatters nothing
+class DiffuseLight : public Material {
+public:
+  DiffuseLight(const Color &emission)
+      : m_texture(emission) {}
+
+  DiffuseLight(std::shared_ptr<Texture> texture)
+      : m_texture(*texture) {}
+
+  bool sample(const Ray &, const HitRecord &, BsdfSample &) const override {
+    return false;
+  }
+
+  Color emitted(const HitRecord &hit_record) const override {
+    if (!hit_record.m_front_face) {
+      return Color(0, 0, 0);
+    }
+    return m_texture.value(hit_record.m_u, hit_record.m_v, hit_record.m_point);
+  }
+
+private:
+  CompiledTexture m_texture;
 };
 
 class Metal : public Material {
@@ -49,16 +140,22 @@ public:
       : m_albedo(albedo)
       , m_fuzz(fuzz < 1 ? fuzz : 1.0) {}
 
-  virtual bool scatter(const Ray &ray_in, const HitRecord &hit_record,
-                       Color &attenuation, Ray &scattered) const override {
+  // The fuzzed reflection has no closed form density, so the whole lobe is
+  // treated as specular
+  bool sample(const Ray &ray_in, const HitRecord &hit_record,
+              BsdfSample &bsdf_sample) const override {
 
     auto reflected = reflect(ray_in.direction(), hit_record.m_normal);
     reflected = unit_vector(reflected) + (m_fuzz * random_unit_vector());
-    scattered = Ray(hit_record.m_point, reflected, ray_in.time());
-    attenuation = m_albedo;
-    return (dot(scattered.direction(), hit_record.m_normal) > 0);
+    bsdf_sample.m_direction = reflected;
+    bsdf_sample.m_weight = m_albedo;
+    bsdf_sample.m_pdf = 0.0;
+    bsdf_sample.m_is_specular = true;
+    return (dot(reflected, hit_record.m_normal) > 0);
   }
 
+  Color albedo(const HitRecord &) const override { return m_albedo; }
+
 private:
   const Color m_albedo;
   const double m_fuzz;
@@ -69,10 +166,8 @@ public:
   Dielectric(const double refraction_index)
       : m_refraction_index(refraction_index) {}
 
-  virtual bool scatter(const Ray &ray_in, const HitRecord &hit_record,
-                       Color &attenuation, Ray &scattered) const override {
-    attenuation = Color(1, 1, 1);
-
+  bool sample(const Ray &ray_in, const HitRecord &hit_record,
+              BsdfSample &bsdf_sample) const override {
     const double refraction_index = hit_record.m_front_face
                                         ? (1.0 / m_refraction_index)
                                         : m_refraction_index;
@@ -92,7 +187,10 @@ public:
             ? reflect(unit_direction, hit_record.m_normal)
             : refract(unit_direction, hit_record.m_normal, refraction_index);
 
-    scattered = Ray(hit_record.m_point, direction, ray_in.time());
+    bsdf_sample.m_direction = direction;
+    bsdf_sample.m_weight = Color(1, 1, 1);
+    bsdf_sample.m_pdf = 0.0;
+    bsdf_sample.m_is_specular = true;
     return true;
   }
 
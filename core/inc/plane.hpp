@@ -0,0 +1,89 @@
+#pragma once
+
+#include <aabb.hpp>
+#include <hittable.hpp>
+#include <material.hpp>
+#include <ray.hpp>
+#include <traversal_stats.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+// An infinite plane through point. Its bounding box is the whole universe,
+// so bounding volume hierarchies keep it out of their nodes and test it next
+// to the tree.
+class Plane final : public Hittable {
+public:
+  Plane(const Point3 &point, const Vec3 &normal,
+        std::shared_ptr<Material> material)
+      : m_point(point)
+      , m_normal(unit_vector(normal))
+      , m_material(material) {
+    // Any two directions in the plane will do for the texture coordinates
+    const Vec3 helper =
+        std::fabs(m_normal.x()) > 0.9 ? Vec3(0, 1, 0) : Vec3(1, 0, 0);
+    m_tangent = unit_vector(cross(helper, m_normal));
+    m_bitangent = cross(m_normal, m_tangent);
+  }
+
+  bool hit(const Ray &ray, Interval ray_t,
+           HitRecord &hit_record) const override {
+    RT_COUNT_PRIMITIVE_TEST();
+
+    double t;
+    if (!intersect(ray, ray_t, t)) {
+      return false;
+    }
+
+    hit_record.m_t = t;
+    hit_record.m_point = ray.at(t);
+    const Vec3 offset = hit_record.m_point - m_point;
+    hit_record.m_u = dot(offset, m_tangent);
+    hit_record.m_v = dot(offset, m_bitangent);
+    hit_record.m_material = m_material.get();
+    hit_record.m_primitive = this;
+    hit_record.set_face_normal(ray, m_normal);
+    return true;
+  }
+
+  bool occluded(const Ray &ray, Interval ray_t) const override {
+    RT_COUNT_PRIMITIVE_TEST();
+
+    double t;
+    return intersect(ray, ray_t, t);
+  }
+
+  AxisAlignedBoundingBox bounding_box() const override {
+    return AxisAlignedBoundingBox::universe;
+  }
+
+  std::uint64_t geometry_hash() const override {
+    std::uint64_t hash = 0;
+    for (const auto &vector : {m_point, m_normal}) {
+      hash = hash_combine(hash, vector.x());
+      hash = hash_combine(hash, vector.y());
+      hash = hash_combine(hash, vector.z());
+    }
+    return hash;
+  }
+
+  const Material *material() const override { return m_material.get(); }
+
+private:
+  bool intersect(const Ray &ray, const Interval &ray_t, double &t) const {
+    const double denominator = dot(m_normal, ray.direction());
+    if (std::fabs(denominator) < 1e-8) {
+      return false;
+    }
+    t = dot(m_normal, m_point - ray.origin()) / denominator;
+    return ray_t.surrounds(t);
+  }
+
+private:
+  Point3 m_point;
+  Vec3 m_normal;
+  Vec3 m_tangent;
+  Vec3 m_bitangent;
+  std::shared_ptr<Material> m_material;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <hittable.hpp>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Where one camera sample's primary ray ended up, 32 bytes in a compact
+// G-buffer so that a re-render which only changes materials or the sky can
+// shade it without tracing the ray again
+struct PrimaryHit {
+  // The ray left the scene
+  static constexpr std::uint32_t missed = 0x7fffffff;
+  // The ray hit something the primitive table doesn't list, it is traced
+  // again on replay
+  static constexpr std::uint32_t untracked = 0x7ffffffe;
+  static constexpr std::uint32_t front_face_flag = 0x80000000;
+
+  double m_t;
+  // Facing the ray, like HitRecord::m_normal
+  std::array<float, 3> m_normal;
+  float m_u;
+  float m_v;
+  // Index into the world's PrimitiveTable or one of the markers above, with
+  // front_face_flag set for hits on the front
+  std::uint32_t m_primitive;
+};
+
+// The primary hits of every sample of one frame, in pixel order and then
+// sample order. The configuration hash ties them to one camera and the
+// geometry of one world, the sample seed to the random numbers each sample
+// drew to make its ray.
+struct PrimaryHitBuffer {
+  std::uint64_t m_configuration_hash = 0;
+  std::uint64_t m_sample_seed = 0;
+  unsigned int m_width = 0;
+  unsigned int m_height = 0;
+  unsigned int m_samples_per_pixel = 0;
+  std::vector<PrimaryHit> m_hits;
+};
+
+// Writes to a temporary file and renames it over the path, like checkpoints.
+// Return false on failure.
+bool write_primary_hits(const std::string &path,
+                        const PrimaryHitBuffer &buffer);
+
+// Only reads the hits if the file's configuration hash, size and sample
+// count are those of the expected header and the file holds exactly that
+// many hits, so a stale or corrupt file costs no more than its header.
+// Returns false and leaves the buffer empty otherwise.
+bool read_primary_hits(const std::string &path,
+                       const PrimaryHitBuffer &expected,
+                       PrimaryHitBuffer &buffer);
+
+// Numbers the primitives of a world so that hits on them can be stored and
+// resolved again in a later run that built the same scene, whose materials
+// may have changed since. Only primitives with a material are listed.
+class PrimitiveTable {
+public:
+  explicit PrimitiveTable(const Hittable &world);
+
+  // Covers the shape and placement of every listed primitive, in order
+  std::uint64_t geometry_hash() const { return m_geometry_hash; }
+
+  // PrimaryHit::untracked for primitives the table doesn't list
+  std::uint32_t index(const Hittable *primitive) const {
+    const auto entry = m_indices.find(primitive);
+    return entry == std::end(m_indices) ? PrimaryHit::untracked
+                                        : entry->second;
+  }
+
+  const Hittable &primitive(const std::uint32_t index) const {
+    return *m_primitives[index];
+  }
+
+  size_t size() const { return m_primitives.size(); }
+
+private:
+  std::vector<const Hittable *> m_primitives;
+  std::unordered_map<const Hittable *, std::uint32_t> m_indices;
+  std::uint64_t m_geometry_hash = 0;
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <aabb.hpp>
+#include <hittable.hpp>
+#include <material.hpp>
+#include <ray.hpp>
+#include <traversal_stats.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+// The parallelogram with corner corner and edges u and v
+class Quad final : public Hittable {
+public:
+  using Hittable::hit;
+  using Hittable::occluded;
+
+  Quad(const Point3 &corner, const Vec3 &u, const Vec3 &v,
+       std::shared_ptr<Material> material)
+      : m_corner(corner)
+      , m_u(u)
+      , m_v(v)
+      , m_material(material) {
+    const Vec3 n = cross(u, v);
+    m_normal = unit_vector(n);
+    m_offset = dot(m_normal, corner);
+    m_w = n / dot(n, n);
+    m_area = n.length();
+
+    // A quad in an axis plane has a flat box, which the slab test would
+    // never hit
+    m_bounding_box =
+        AxisAlignedBoundingBox(AxisAlignedBoundingBox(corner, corner + u + v),
+                               AxisAlignedBoundingBox(corner + u, corner + v))
+            .padded(0.0001);
+  }
+
+  bool hit(const Ray &ray, Interval ray_t,
+           HitRecord &hit_record) const override {
+    RT_COUNT_PRIMITIVE_TEST();
+
+    double t, alpha, beta;
+    if (!intersect(ray, ray_t, t, alpha, beta)) {
+      return false;
+    }
+
+    hit_record.m_t = t;
+    hit_record.m_point = ray.at(t);
+    hit_record.m_u = alpha;
+    hit_record.m_v = beta;
+    hit_record.m_material = m_material.get();
+    hit_record.m_primitive = this;
+    hit_record.set_face_normal(ray, m_normal);
+    return true;
+  }
+
+  bool occluded(const Ray &ray, Interval ray_t) const override {
+    RT_COUNT_PRIMITIVE_TEST();
+
+    double t, alpha, beta;
+    return intersect(ray, ray_t, t, alpha, beta);
+  }
+
+  AxisAlignedBoundingBox bounding_box() const override {
+    return m_bounding_box;
+  }
+
+  // The box leaves open which way the quad spans it
+  std::uint64_t geometry_hash() const override {
+    std::uint64_t hash = 0;
+    for (const auto &vector : {m_corner, m_u, m_v}) {
+      hash = hash_combine(hash, vector.x());
+      hash = hash_combine(hash, vector.y());
+      hash = hash_combine(hash, vector.z());
+    }
+    return hash;
+  }
+
+  const Material *material() const override { return m_material.get(); }
+
+  // Uniform over the quad's area, converted to solid angle
+  double pdf_value(const Point3 &origin, const Vec3 &direction,
+                   const double time) const override {
+    double t, alpha, beta;
+    if (!intersect(Ray(origin, direction, time), Interval(0.001, infinity), t,
+                   alpha, beta)) {
+      return 0.0;
+    }
+    const double distance_squared = t * t * direction.length_squared();
+    const double cosine =
+        std::fabs(dot(direction, m_normal)) / direction.length();
+    return distance_squared / (cosine * m_area);
+  }
+
+  Vec3 random_direction(const Point3 &origin, const double) const override {
+    return m_corner + random_double() * m_u + random_double() * m_v - origin;
+  }
+
+private:
+  // Finds where the ray crosses the quad's plane in ray_t, and whether that
+  // is inside the quad. alpha and beta are the point's coordinates along u
+  // and v.
+  bool intersect(const Ray &ray, const Interval &ray_t, double &t,
+                 double &alpha, double &beta) const {
+    const double denominator = dot(m_normal, ray.direction());
+    if (std::fabs(denominator) < 1e-8) {
+      return false;
+    }
+
+    t = (m_offset - dot(m_normal, ray.origin())) / denominator;
+    if (!ray_t.surrounds(t)) {
+      return false;
+    }
+
+    const Vec3 planar = ray.at(t) - m_corner;
+    alpha = dot(m_w, cross(planar, m_v));
+    beta = dot(m_w, cross(m_u, planar));
+    return 0.0 <= alpha && alpha <= 1.0 && 0.0 <= beta && beta <= 1.0;
+  }
+
+private:
+  Point3 m_corner;
+  Vec3 m_u;
+  Vec3 m_v;
+  Vec3 m_normal;
+  // Of the quad's plane from the origin along the normal
+  double m_offset;
+  // Turns a point in the plane into its coordinates along u and v
+  Vec3 m_w;
+  double m_area;
+  std::shared_ptr<Material> m_material;
+  AxisAlignedBoundingBox m_bounding_box;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <ray.hpp>
+#include <vec3.hpp>
+
+#include <array>
+#include <cmath>
+
+// What the box and primitive tests need to know about a ray, worked out once
+// when traversal starts instead of for every node and primitive it visits
+class RayQuery {
+public:
+  explicit RayQuery(const Ray &ray)
+      : m_ray(ray)
+      , m_inverse_direction(1.0 / ray.direction().x(),
+                            1.0 / ray.direction().y(),
+                            1.0 / ray.direction().z())
+      , m_direction_is_negative{std::signbit(ray.direction().x()),
+                                std::signbit(ray.direction().y()),
+                                std::signbit(ray.direction().z())}
+      , m_direction_length_squared(ray.direction().length_squared()) {}
+
+  const Ray &ray() const { return m_ray; }
+  const Point3 &origin() const { return m_ray.origin(); }
+  const Vec3 &direction() const { return m_ray.direction(); }
+  double time() const { return m_ray.time(); }
+
+  // Infinite along axes the ray runs parallel to
+  const Vec3 &inverse_direction() const { return m_inverse_direction; }
+
+  // Set for negative components, -0 included, so that the slab test picks
+  // the same near plane as the sign of the infinite inverse
+  bool direction_is_negative(const size_t axis_index) const {
+    return m_direction_is_negative[axis_index];
+  }
+
+  double direction_length_squared() const { return m_direction_length_squared; }
+
+private:
+  Ray m_ray;
+  Vec3 m_inverse_direction;
+  std::array<bool, 3> m_direction_is_negative;
+  double m_direction_length_squared;
+};
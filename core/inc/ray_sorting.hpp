@@ -0,0 +1,42 @@
+#pragma once
+
+#include <aabb.hpp>
+#include <ray.hpp>
+#include <vec3.hpp>
+
+#include <algorithm>
+#include <cstdint>
+
+// Spreads the low 10 bits of value out to every third bit
+inline std::uint32_t expand_bits(std::uint32_t value) {
+  value &= 0x3ff;
+  value = (value | (value << 16)) & 0x030000ff;
+  value = (value | (value << 8)) & 0x0300f00f;
+  value = (value | (value << 4)) & 0x030c30c3;
+  value = (value | (value << 2)) & 0x09249249;
+  return value;
+}
+
+// Orders rays so that neighbours in the order start close together and head
+// the same way, and so tend to visit the same BVH nodes. The direction is
+// quantized to 4 bins per axis in the top 6 bits, below that is the Morton
+// code of the origin quantized to 10 bits per axis within origin_bounds.
+inline std::uint64_t ray_sort_key(const Ray &ray,
+                                  const AxisAlignedBoundingBox &origin_bounds) {
+  const Vec3 direction = unit_vector(ray.direction());
+  std::uint64_t direction_bits = 0;
+  std::uint32_t origin_bits = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    const auto bin = std::uint64_t(std::clamp(
+        int((direction[axis] + 1.0) * 2.0), 0, 3));
+    direction_bits = (direction_bits << 2) | bin;
+
+    const Interval &extent = origin_bounds.axis_interval(axis);
+    const double relative =
+        extent.size() > 0 ? (ray.origin()[axis] - extent.m_min) / extent.size()
+                          : 0.0;
+    const auto cell = std::uint32_t(std::clamp(relative * 1024.0, 0.0, 1023.0));
+    origin_bits |= expand_bits(cell) << (2 - axis);
+  }
+  return (direction_bits << 30) | origin_bits;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <aabb.hpp>
+#include <hittable.hpp>
+#include <thread_pool.hpp>
+
+#include <memory>
+#include <vector>
+
+// One copy of the world per NUMA node. Pinned worker threads traverse the
+// copy on their own node instead of reaching across the interconnect.
+class ReplicatedWorld : public Hittable {
+public:
+  explicit ReplicatedWorld(std::vector<std::shared_ptr<Hittable>> replicas)
+      : m_replicas(std::move(replicas)) {}
+
+  bool hit(const Ray &ray, Interval ray_t,
+           HitRecord &hit_record) const override {
+    return local_replica().hit(ray, ray_t, hit_record);
+  }
+
+  bool occluded(const Ray &ray, Interval ray_t) const override {
+    return local_replica().occluded(ray, ray_t);
+  }
+
+  AxisAlignedBoundingBox bounding_box() const override {
+    return m_replicas.front()->bounding_box();
+  }
+
+  std::array<AxisAlignedBoundingBox, 2> motion_bounds() const override {
+    return m_replicas.front()->motion_bounds();
+  }
+
+  // Every copy, since each thread hits the primitives of its own
+  void
+  collect_primitives(std::vector<const Hittable *> &primitives) const override {
+    for (const auto &replica : m_replicas) {
+      replica->collect_primitives(primitives);
+    }
+  }
+
+private:
+  const Hittable &local_replica() const {
+    return *m_replicas[ThreadPool::current_node() % m_replicas.size()];
+  }
+
+  std::vector<std::shared_ptr<Hittable>> m_replicas;
+};
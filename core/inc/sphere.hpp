@@ -4,10 +4,11 @@
 #include <hittable.hpp>
 #include <material.hpp>
 #include <ray.hpp>
+#include <traversal_stats.hpp>
 
 #include <cmath>
 
-class Sphere : public Hittable {
+class Sphere final : public Hittable {
 public:
   // Stationary
   Sphere(const Point3 &static_center, double radius,
@@ -26,11 +27,115 @@ public:
       , m_material(material)
       , m_bounding_box(calculate_moving_bounding_box()) {}
 
+  // Moves the sphere, from center1 at time 0 to center2 at time 1
+  void move_to(const Point3 &center1, const Point3 &center2) {
+    m_center = Ray(center1, center2 - center1);
+    m_bounding_box = calculate_moving_bounding_box();
+  }
+
   bool hit(const Ray &ray, Interval ray_t,
            HitRecord &hit_record) const override {
+    return hit(ray, ray.direction().length_squared(), ray_t, hit_record);
+  }
+
+  bool hit(const RayQuery &query, Interval ray_t,
+           HitRecord &hit_record) const {
+    return hit(query.ray(), query.direction_length_squared(), ray_t,
+               hit_record);
+  }
+
+  bool occluded(const Ray &ray, Interval ray_t) const override {
+    RT_COUNT_PRIMITIVE_TEST();
+
+    double root;
+    return nearest_root(ray, ray.direction().length_squared(), ray_t,
+                        m_center.at(ray.time()), root);
+  }
+
+  bool occluded(const RayQuery &query, Interval ray_t) const {
+    RT_COUNT_PRIMITIVE_TEST();
+
+    double root;
+    return nearest_root(query.ray(), query.direction_length_squared(), ray_t,
+                        m_center.at(query.time()), root);
+  }
+
+  AxisAlignedBoundingBox bounding_box() const override {
+    return m_bounding_box;
+  }
+
+  // The center moves linearly, so blending these is exact
+  std::array<AxisAlignedBoundingBox, 2> motion_bounds() const override {
+    return {AxisAlignedBoundingBox(m_center.at(0) - radius_vector(),
+                                   m_center.at(0) + radius_vector()),
+            AxisAlignedBoundingBox(m_center.at(1) - radius_vector(),
+                                   m_center.at(1) + radius_vector())};
+  }
+
+  const Material *material() const override { return m_material.get(); }
+
+  // Samples the cone of directions under which the sphere is seen, which is
+  // uniform in solid angle and never wastes a sample on a miss
+  double pdf_value(const Point3 &origin, const Vec3 &direction,
+                   const double time) const override {
+    const Vec3 to_center = m_center.at(time) - origin;
+    const double distance_squared = to_center.length_squared();
+    const double one_minus_cos_max = cone_one_minus_cos_max(distance_squared);
+    if (one_minus_cos_max <= 0.0) {
+      return 0.0;
+    }
+    const double cosine =
+        dot(to_center, direction) /
+        std::sqrt(distance_squared * direction.length_squared());
+    if (cosine < 1.0 - one_minus_cos_max) {
+      return 0.0;
+    }
+    return 1.0 / (2 * pi * one_minus_cos_max);
+  }
+
+  Vec3 random_direction(const Point3 &origin,
+                        const double time) const override {
+    const Vec3 to_center = m_center.at(time) - origin;
+    const double distance_squared = to_center.length_squared();
+    const double one_minus_cos_max = cone_one_minus_cos_max(distance_squared);
+    if (one_minus_cos_max <= 0.0) {
+      return random_unit_vector();
+    }
+    const double phi = 2 * pi * random_double();
+    const double z = 1.0 - random_double() * one_minus_cos_max;
+    const double radius = std::sqrt(std::fmax(0.0, 1.0 - z * z));
+    return local_to_world(
+        Vec3(radius * std::cos(phi), radius * std::sin(phi), z),
+        to_center / std::sqrt(distance_squared));
+  }
+
+private:
+  bool hit(const Ray &ray, const double direction_length_squared,
+           const Interval ray_t, HitRecord &hit_record) const {
+    RT_COUNT_PRIMITIVE_TEST();
+
     const Vec3 current_center = m_center.at(ray.time());
+    double root;
+    if (!nearest_root(ray, direction_length_squared, ray_t, current_center,
+                      root)) {
+      return false;
+    }
+
+    hit_record.m_t = root;
+    hit_record.m_point = ray.at(root);
+    hit_record.m_material = m_material.get();
+    hit_record.m_primitive = this;
+    Vec3 outward_normal = (hit_record.m_point - current_center) / m_radius;
+    hit_record.set_face_normal(ray, outward_normal);
+    return true;
+  }
+
+  // Finds the nearest intersection in ray_t, if there is one
+  bool nearest_root(const Ray &ray, const double direction_length_squared,
+                    const Interval &ray_t, const Point3 &current_center,
+                    double &root) const {
     const Vec3 origin_to_center = current_center - ray.origin();
-    const auto a = ray.direction().length_squared();
+    const auto a = direction_length_squared;
     const auto h = dot(ray.direction(), origin_to_center);
     const auto c = origin_to_center.length_squared() - m_radius * m_radius;
 
@@ -42,27 +147,27 @@ public:
     const auto sqrt_discriminant = std::sqrt(discriminant);
 
     // Find nearest root that lies in the acceptable range
-    auto root = (h - sqrt_discriminant) / a;
+    root = (h - sqrt_discriminant) / a;
     if (!ray_t.surrounds(root)) {
       root = (h + sqrt_discriminant) / a;
       if (!ray_t.surrounds(root)) {
         return false;
       }
     }
-
-    hit_record.m_t = root;
-    hit_record.m_point = ray.at(root);
-    hit_record.m_material = m_material;
-    Vec3 outward_normal = (hit_record.m_point - current_center) / m_radius;
-    hit_record.set_face_normal(ray, outward_normal);
     return true;
   }
 
-  AxisAlignedBoundingBox bounding_box() const override {
-    return m_bounding_box;
+  // 1 - cos of the half angle of the cone seen from that far away, written
+  // so that small lights far away don't cancel down to zero. Zero from
+  // inside the sphere, where there is no cone to sample.
+  double cone_one_minus_cos_max(const double distance_squared) const {
+    const double ratio = m_radius * m_radius / distance_squared;
+    if (ratio >= 1.0) {
+      return 0.0;
+    }
+    return ratio / (1.0 + std::sqrt(1.0 - ratio));
   }
 
-private:
   Vec3 radius_vector() const { return Vec3(m_radius, m_radius, m_radius); }
 
   AxisAlignedBoundingBox calculate_moving_bounding_box() {
@@ -74,8 +179,8 @@ private:
   }
 
 private:
-  const Ray m_center;
+  Ray m_center;
   const double m_radius;
   std::shared_ptr<Material> m_material;
-  const AxisAlignedBoundingBox m_bounding_box;
+  AxisAlignedBoundingBox m_bounding_box;
 };
@@ -4,13 +4,34 @@
 #include <vec3.hpp>
 
 #include <cmath>
+#include <cstdint>
 #include <memory>
+#include <vector>
 
+// One step of a compiled texture graph. Each node is followed by its first
+// input, checkers also know where their second one starts.
+struct TextureInstruction {
+  enum class Opcode : std::uint8_t { Constant, Checker };
+
+  Opcode m_opcode;
+  // Checker: index of the odd input
+  std::uint32_t m_odd;
+  // Checker
+  double m_inverse_scale;
+  // Constant
+  Color m_color;
+};
+
+// Textures describe a graph as scenes are built. Materials compile it into
+// a CompiledTexture rather than calling value through the nodes.
 class Texture {
 public:
   virtual ~Texture() = default;
 
   virtual Color value(double u, double v, const Point3 &point) const = 0;
+
+  // Appends the instructions of this node and its inputs
+  virtual void compile(std::vector<TextureInstruction> &program) const = 0;
 };
 
 class SolidColor : public Texture {
@@ -25,6 +46,11 @@ public:
     return m_albedo;
   }
 
+  void compile(std::vector<TextureInstruction> &program) const override {
+    program.push_back(TextureInstruction{
+        TextureInstruction::Opcode::Constant, 0, 0.0, m_albedo});
+  }
+
 private:
   const Color m_albedo;
 };
@@ -42,14 +68,37 @@ public:
                        std::make_shared<SolidColor>(color_2)) {}
 
   virtual Color value(double u, double v, const Point3 &point) const override {
+    return is_even(m_inverse_scale, point) ? m_even->value(u, v, point)
+                                           : m_odd->value(u, v, point);
+  }
 
-    const auto x_int = int(std::floor(m_inverse_scale * point.x()));
-    const auto y_int = int(std::floor(m_inverse_scale * point.y()));
-    const auto z_int = int(std::floor(m_inverse_scale * point.z()));
+  void compile(std::vector<TextureInstruction> &program) const override {
+    const size_t checker = program.size();
+    program.push_back(TextureInstruction{
+        TextureInstruction::Opcode::Checker, 0, m_inverse_scale, Color()});
+    m_even->compile(program);
+    const size_t odd = program.size();
+    program[checker].m_odd = std::uint32_t(odd);
+    m_odd->compile(program);
 
-    const bool is_even = (x_int + y_int + z_int) % 2 == 0;
+    // A checker between two equal colours is that colour
+    const auto &even_input = program[checker + 1];
+    const auto &odd_input = program[odd];
+    if (program.size() == checker + 3 &&
+        even_input.m_opcode == TextureInstruction::Opcode::Constant &&
+        odd_input.m_opcode == TextureInstruction::Opcode::Constant &&
+        even_input.m_color == odd_input.m_color) {
+      program[checker] = even_input;
+      program.resize(checker + 1);
+    }
+  }
 
-    return is_even ? m_even->value(u, v, point) : m_odd->value(u, v, point);
+  static bool is_even(const double inverse_scale, const Point3 &point) {
+    const auto x_int = int(std::floor(inverse_scale * point.x()));
+    const auto y_int = int(std::floor(inverse_scale * point.y()));
+    const auto z_int = int(std::floor(inverse_scale * point.z()));
+
+    return (x_int + y_int + z_int) % 2 == 0;
   }
 
 private:
@@ -57,3 +106,47 @@ private:
   std::shared_ptr<Texture> m_even;
   std::shared_ptr<Texture> m_odd;
 };
+
+// A texture graph flattened into one array of instructions, evaluated by a
+// loop over a switch instead of virtual calls through the nodes. A graph
+// that folds down to a single colour keeps it inline and never touches the
+// array.
+class CompiledTexture {
+public:
+  CompiledTexture(const Color &color)
+      : m_color(color) {}
+
+  CompiledTexture(const Texture &texture) {
+    texture.compile(m_program);
+    if (m_program.size() == 1) {
+      m_color = m_program.front().m_color;
+      m_program.clear();
+    }
+    m_program.shrink_to_fit();
+  }
+
+  Color value(const double, const double, const Point3 &point) const {
+    if (m_program.empty()) {
+      return m_color;
+    }
+
+    // Only the input a node picks is run, the even one directly follows it
+    size_t index = 0;
+    for (;;) {
+      const auto &instruction = m_program[index];
+      switch (instruction.m_opcode) {
+      case TextureInstruction::Opcode::Constant:
+        return instruction.m_color;
+      case TextureInstruction::Opcode::Checker:
+        index = CheckerTexture::is_even(instruction.m_inverse_scale, point)
+                    ? index + 1
+                    : instruction.m_odd;
+        break;
+      }
+    }
+  }
+
+private:
+  Color m_color;
+  std::vector<TextureInstruction> m_program;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+enum class ThreadPlacement {
+  // Leave the threads to the scheduler
+  None,
+  // Fill the CPUs of one NUMA node before moving on to the next
+  Compact,
+  // Deal the threads out over the NUMA nodes in turn
+  Scatter
+};
+
+// The CPUs this process may run on, grouped by NUMA node. Without NUMA
+// information from the kernel everything is one node.
+struct CpuTopology {
+  std::vector<std::vector<unsigned int>> m_node_cpus;
+
+  unsigned int num_cpus() const;
+  unsigned int num_nodes() const { return (unsigned int)m_node_cpus.size(); }
+  unsigned int node_of_cpu(unsigned int cpu) const;
+};
+
+CpuTopology detect_cpu_topology();
+
+// The CPU for each of num_threads threads, wrapping around when there are
+// more threads than CPUs
+std::vector<unsigned int> assign_cpus(const CpuTopology &topology,
+                                      ThreadPlacement placement,
+                                      unsigned int num_threads);
+
+// Returns false if the kernel refused
+bool pin_current_thread(unsigned int cpu);
+
+// Gives the whole pages in [data, data + bytes) back to the kernel. They read
+// as zeros afterwards and land on the node of whichever thread touches them
+// first, so only use this on memory that is all zeros anyway.
+void release_pages(void *data, size_t bytes);
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <thread_placement.hpp>
+#include <tracer.hpp>
+
 #include <algorithm>
+#include <condition_variable>
 #include <functional>
 #include <iostream>
 #include <list>
@@ -13,11 +17,10 @@ class ThreadPool {
 public:
   using t_JobFunction = std::function<void(void)>;
 
-  ThreadPool(const unsigned int num_threads)
-      : m_num_threads(
-            std::min<unsigned int>(
-                std::max<unsigned int>(std::thread::hardware_concurrency(), 2) - 1,
-                std::max<unsigned int>(num_threads, 1)))
+  ThreadPool(const unsigned int num_threads,
+             const ThreadPlacement placement = ThreadPlacement::None)
+      : m_num_threads(std::max<unsigned int>(num_threads, 1))
+      , m_placement(placement)
       , m_should_terminate(false)
       , m_in_flight(0)
       , m_jobs_added(0)
@@ -25,17 +28,55 @@ public:
     std::clog << "Hardware concurrency: " << std::thread::hardware_concurrency()
               << " threads" << std::endl;
     std::clog << "Using: " << m_num_threads << " threads" << std::endl;
+    if (m_placement != ThreadPlacement::None) {
+      const auto topology = detect_cpu_topology();
+      m_thread_cpus = assign_cpus(topology, m_placement, m_num_threads);
+      for (const auto cpu : m_thread_cpus) {
+        m_thread_nodes.push_back(topology.node_of_cpu(cpu));
+      }
+      std::clog << "Pinned " << (m_placement == ThreadPlacement::Compact
+                                     ? "compactly"
+                                     : "scattered")
+                << " over " << topology.num_cpus() << " CPUs on "
+                << topology.num_nodes() << " NUMA nodes" << std::endl;
+    }
     m_threads.reserve(m_num_threads);
   }
 
   ThreadPool()
-      : ThreadPool(std::thread::hardware_concurrency()) {}
+      : ThreadPool(default_num_threads()) {}
+
+  // One core is left for the main thread
+  static unsigned int default_num_threads() {
+    return std::max<unsigned int>(std::thread::hardware_concurrency(), 2) - 1;
+  }
+
+  // The index of the worker thread calling this and the NUMA node it is
+  // pinned to, both zero outside a pool
+  static unsigned int current_thread() { return worker_state().m_thread; }
+  static unsigned int current_node() { return worker_state().m_node; }
+
+  unsigned int num_threads() const { return m_num_threads; }
+  ThreadPlacement placement() const { return m_placement; }
+
+  ~ThreadPool() {
+    if (is_running()) {
+      stop();
+    }
+  }
+
+  bool is_running() const { return !m_threads.empty(); }
 
   void start() {
+    {
+      // Allow the pool to be started again after stop()
+      std::unique_lock<std::mutex> lock(m_job_queue_mutex);
+      m_should_terminate = false;
+    }
     for (unsigned int thread_index = 0; thread_index < m_num_threads;
          ++thread_index) {
       // Create threads
-      m_threads.emplace_back(&ThreadPool::thread_loop, this);
+      m_threads.emplace_back(&ThreadPool::thread_loop, this, thread_index);
     }
   }
 
@@ -48,6 +89,31 @@ public:
     m_job_queue_mutex_condition.notify_one();
   }
 
+  // Runs the function once on every worker thread and waits for all of them.
+  // Each job holds on to its thread until every thread has one, so the pool
+  // must be running and have nothing else queued.
+  void run_on_each_thread(const std::function<void(unsigned int)> &function) {
+    std::mutex started_mutex;
+    std::condition_variable all_started;
+    unsigned int num_started = 0;
+    for (unsigned int thread_index = 0; thread_index < m_num_threads;
+         ++thread_index) {
+      add_job([&] {
+        {
+          std::unique_lock<std::mutex> lock(started_mutex);
+          if (++num_started == m_num_threads) {
+            all_started.notify_all();
+          } else {
+            all_started.wait(lock,
+                             [&] { return num_started == m_num_threads; });
+          }
+        }
+        function(current_thread());
+      });
+    }
+    wait_for_empty_job_queue();
+  }
+
   void wait_for_empty_job_queue() {
     {
       std::unique_lock<std::mutex> lock(m_job_queue_mutex);
@@ -78,10 +144,29 @@ public:
   }
 
 private:
-  void thread_loop() {
+  struct WorkerState {
+    unsigned int m_thread = 0;
+    unsigned int m_node = 0;
+  };
+
+  static WorkerState &worker_state() {
+    thread_local WorkerState state;
+    return state;
+  }
+
+  void thread_loop(const unsigned int thread_index) {
+    worker_state().m_thread = thread_index;
+    if (!m_thread_cpus.empty()) {
+      pin_current_thread(m_thread_cpus[thread_index]);
+      worker_state().m_node = m_thread_nodes[thread_index];
+    }
+    tracer().set_thread_name("worker " + std::to_string(thread_index));
+
     for (;;) {
       t_JobFunction job;
       {
+        // Idle time, and contention on the queue
+        const TraceScope trace("wait", "pool");
         std::unique_lock<std::mutex> lock(m_job_queue_mutex);
         m_job_queue_mutex_condition.wait(lock, [this] {
           return !m_job_queue.empty() || m_should_terminate;
@@ -93,7 +178,11 @@ private:
         m_job_queue.pop();
         ++m_in_flight;
       }
-      job();
+      {
+        const TraceScope trace("job", "pool");
+        job();
+      }
+      const TraceScope trace("finish_job", "pool");
       {
         std::unique_lock<std::mutex> lock(m_job_queue_mutex);
         --m_in_flight;
@@ -112,6 +201,10 @@ private:
 
 private:
   const unsigned int m_num_threads;
+  const ThreadPlacement m_placement;
+  // Empty unless the threads are pinned
+  std::vector<unsigned int> m_thread_cpus;
+  std::vector<unsigned int> m_thread_nodes;
   bool m_should_terminate;
   unsigned int m_in_flight;
   std::mutex m_job_queue_mutex;
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A span of work on one thread, in nanoseconds since the tracer started.
+// Names and categories must be string literals, they are never copied.
+struct TraceEvent {
+  const char *m_name;
+  const char *m_category;
+  // Negative when there is none, otherwise shown with the event, such as
+  // the row a job rendered
+  std::int64_t m_argument;
+  std::uint64_t m_begin_ns;
+  std::uint64_t m_end_ns;
+};
+
+// Records what every thread spends its time on, for a timeline in
+// chrome://tracing or Perfetto. Each thread writes into its own ring buffer
+// without locking, and once the buffer is full the oldest events are
+// overwritten. Off unless started, a disabled tracer costs a TraceScope one
+// relaxed load.
+class Tracer {
+public:
+  // Buffers left from an earlier run are emptied, so call this while no
+  // other thread is recording
+  void start(size_t events_per_thread);
+  void stop() { m_enabled.store(false, std::memory_order_relaxed); }
+
+  bool is_enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+  std::uint64_t now_ns() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - m_start)
+        .count();
+  }
+
+  void record(const TraceEvent &event);
+
+  // Labels the calling thread's track in the timeline
+  void set_thread_name(const std::string &name);
+
+  // The Chrome trace event format. The threads that recorded must have
+  // finished or been joined, their buffers are read without locking.
+  void write_chrome_trace(std::ostream &out) const;
+
+private:
+  struct ThreadBuffer {
+    unsigned int m_thread_id;
+    std::string m_name;
+    std::vector<TraceEvent> m_events;
+    // Events ever recorded, the next one goes to m_next % size
+    size_t m_next = 0;
+  };
+
+  ThreadBuffer &thread_buffer();
+
+  std::atomic<bool> m_enabled{false};
+  size_t m_events_per_thread = 0;
+  std::chrono::steady_clock::time_point m_start;
+  // Only taken when a thread records its first event
+  mutable std::mutex m_buffers_mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+  // Tells threads that a restart emptied the buffers they point at
+  unsigned int m_generation = 0;
+};
+
+inline Tracer &tracer() {
+  static Tracer instance;
+  return instance;
+}
+
+// Records the time from its construction to its destruction as one event
+class TraceScope {
+public:
+  TraceScope(const char *name, const char *category,
+             const std::int64_t argument = -1)
+      : m_event{name, category, argument, 0, 0}
+      , m_is_enabled(tracer().is_enabled()) {
+    if (m_is_enabled) {
+      m_event.m_begin_ns = tracer().now_ns();
+    }
+  }
+
+  ~TraceScope() {
+    if (m_is_enabled) {
+      m_event.m_end_ns = tracer().now_ns();
+      tracer().record(m_event);
+    }
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+  TraceEvent m_event;
+  const bool m_is_enabled;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+// Per thread counters of the work done by ray queries. They are only updated
+// when built with -DRT_TRAVERSAL_STATS=ON, otherwise every counting macro
+// expands to nothing and traversal is exactly as fast as without them.
+
+struct TraversalStats {
+  unsigned long m_nodes_visited = 0;
+  unsigned long m_boxes_tested = 0;
+  unsigned long m_primitives_tested = 0;
+};
+
+inline TraversalStats &traversal_stats() {
+  thread_local TraversalStats stats;
+  return stats;
+}
+
+#ifdef RT_TRAVERSAL_STATS
+
+constexpr bool traversal_stats_enabled = true;
+
+#define RT_COUNT_NODE_VISIT() (++traversal_stats().m_nodes_visited)
+#define RT_COUNT_BOX_TEST() (++traversal_stats().m_boxes_tested)
+#define RT_COUNT_PRIMITIVE_TEST() (++traversal_stats().m_primitives_tested)
+
+#else
+
+constexpr bool traversal_stats_enabled = false;
+
+#define RT_COUNT_NODE_VISIT() ((void)0)
+#define RT_COUNT_BOX_TEST() ((void)0)
+#define RT_COUNT_PRIMITIVE_TEST() ((void)0)
+
+#endif
@@ -17,6 +17,8 @@ public:
   double y() const { return m_elements[1]; }
   double z() const { return m_elements[2]; }
 
+  bool operator==(const Vec3 &) const = default;
+
   Vec3 operator-() const {
     return Vec3(-m_elements[0], -m_elements[1], -m_elements[2]);
   }
@@ -162,3 +164,12 @@ inline Vec3 refract(const Vec3 &uv, const Vec3 &n,
       -std::sqrt(std::fabs(1.0 - r_out_perpendicular.length_squared())) * n;
   return r_out_perpendicular + r_out_parallel;
 }
+
+// Turns a direction given relative to the unit vector w, with w as its z
+// axis, into world space
+inline Vec3 local_to_world(const Vec3 &local, const Vec3 &w) {
+  const Vec3 helper = std::fabs(w.x()) > 0.9 ? Vec3(0, 1, 0) : Vec3(1, 0, 0);
+  const Vec3 v = unit_vector(cross(w, helper));
+  const Vec3 u = cross(w, v);
+  return local.x() * u + local.y() * v + local.z() * w;
+}
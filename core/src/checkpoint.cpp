@@ -0,0 +1,99 @@
+#include <checkpoint.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <utility>
+
+namespace {
+
+constexpr char checkpoint_magic[4] = {'R', 'T', 'C', 'K'};
+constexpr std::uint32_t checkpoint_version = 1;
+
+template <typename T> void write_value(std::ostream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> bool read_value(std::istream &in, T &value) {
+  return bool(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+} // namespace
+
+bool write_checkpoint(const std::string &path, const Checkpoint &checkpoint) {
+  const std::string temporary_path = path + ".tmp";
+  {
+    std::ofstream out(temporary_path, std::ios::binary);
+    out.write(checkpoint_magic, sizeof(checkpoint_magic));
+    write_value(out, checkpoint_version);
+    write_value(out, checkpoint.m_configuration_hash);
+    write_value(out, checkpoint.m_sample_seed);
+    write_value(out, checkpoint.m_width);
+    write_value(out, checkpoint.m_height);
+    out.write(reinterpret_cast<const char *>(checkpoint.m_row_samples.data()),
+              checkpoint.m_row_samples.size() * sizeof(unsigned int));
+    for (const auto &sum : checkpoint.m_accumulation) {
+      write_value(out, sum.x());
+      write_value(out, sum.y());
+      write_value(out, sum.z());
+    }
+    if (!out) {
+      return false;
+    }
+  }
+  return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+}
+
+bool read_checkpoint(const std::string &path, const Checkpoint &expected,
+                     Checkpoint &checkpoint) {
+  checkpoint = Checkpoint{};
+
+  std::ifstream in(path, std::ios::binary);
+  char magic[sizeof(checkpoint_magic)];
+  std::uint32_t version;
+  if (!in.read(magic, sizeof(magic)) ||
+      !std::equal(magic, magic + sizeof(magic), checkpoint_magic) ||
+      !read_value(in, version) || version != checkpoint_version) {
+    return false;
+  }
+
+  Checkpoint header;
+  if (!read_value(in, header.m_configuration_hash) ||
+      !read_value(in, header.m_sample_seed) ||
+      !read_value(in, header.m_width) || !read_value(in, header.m_height)) {
+    return false;
+  }
+  if (header.m_configuration_hash != expected.m_configuration_hash ||
+      header.m_width != expected.m_width ||
+      header.m_height != expected.m_height) {
+    return false;
+  }
+
+  // The rest of the file has to be exactly the row counts and the sums
+  const size_t num_pixels = size_t(header.m_width) * header.m_height;
+  const auto body_start = in.tellg();
+  in.seekg(0, std::ios::end);
+  if (!in || in.tellg() - body_start !=
+                 std::streamoff(header.m_height * sizeof(unsigned int) +
+                                num_pixels * 3 * sizeof(double))) {
+    return false;
+  }
+  in.seekg(body_start);
+
+  header.m_row_samples.resize(header.m_height);
+  if (!in.read(reinterpret_cast<char *>(header.m_row_samples.data()),
+               header.m_row_samples.size() * sizeof(unsigned int))) {
+    return false;
+  }
+
+  header.m_accumulation.resize(num_pixels);
+  for (auto &sum : header.m_accumulation) {
+    double x, y, z;
+    if (!read_value(in, x) || !read_value(in, y) || !read_value(in, z)) {
+      return false;
+    }
+    sum = Color(x, y, z);
+  }
+  checkpoint = std::move(header);
+  return true;
+}
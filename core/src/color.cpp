@@ -1,5 +1,6 @@
 #include <color.hpp>
 
+#include <algorithm>
 #include <iostream>
 
 int scale_to_int(double val) { return int(256.0 * val); }
@@ -20,3 +21,15 @@ void write_color(std::ostream &out, const Color &pixel_color) {
       << scale_to_int(intensity.clamp(linear_to_gamma(pixel_color.z())))
       << "\n";
 }
+
+Color false_color(const double value) {
+  static const Color ramp[] = {Color(0.0, 0.0, 0.5), Color(0.0, 0.4, 1.0),
+                               Color(0.0, 0.9, 0.6), Color(0.6, 1.0, 0.0),
+                               Color(1.0, 0.6, 0.0), Color(0.8, 0.0, 0.0)};
+  constexpr int last = sizeof(ramp) / sizeof(ramp[0]) - 1;
+
+  const double position = Interval(0.0, 1.0).clamp(value) * last;
+  const int index = std::min(int(position), last - 1);
+  const double alpha = position - index;
+  return (1.0 - alpha) * ramp[index] + alpha * ramp[index + 1];
+}
@@ -0,0 +1,167 @@
+#include <denoiser.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Keeps the albedo division stable on black surfaces
+constexpr double albedo_epsilon = 1e-3;
+
+// B3 spline, the classic à-trous kernel
+constexpr double kernel[5] = {1.0 / 16, 1.0 / 4, 3.0 / 8, 1.0 / 4, 1.0 / 16};
+
+Color demodulate(const Color &color, const Color &albedo) {
+  return Color(color.x() / (albedo.x() + albedo_epsilon),
+               color.y() / (albedo.y() + albedo_epsilon),
+               color.z() / (albedo.z() + albedo_epsilon));
+}
+
+double normal_weight(const Vec3 &normal, const Vec3 &other_normal,
+                     const double exponent) {
+  const double lengths =
+      std::sqrt(normal.length_squared() * other_normal.length_squared());
+  if (lengths == 0.0) {
+    // Two misses are the same background, a miss and a hit are an edge
+    return normal.length_squared() == other_normal.length_squared() ? 1.0
+                                                                    : 0.0;
+  }
+  return std::pow(std::max(0.0, dot(normal, other_normal) / lengths),
+                  exponent);
+}
+
+// Illumination and its variance, filtered in place level by level
+struct Signal {
+  std::vector<Color> m_illumination;
+  std::vector<double> m_variance;
+};
+
+struct Level {
+  const Signal *m_input;
+  Signal *m_output;
+  int m_step;
+};
+
+void filter_row(const int row, const Level &level,
+                const AuxiliaryBuffers &auxiliary,
+                const DenoiseSettings &settings) {
+  const int width = int(auxiliary.m_albedo.m_width);
+  const int height = int(auxiliary.m_albedo.m_height);
+  const auto &illumination = level.m_input->m_illumination;
+  const auto &variance = level.m_input->m_variance;
+  const auto &normals = auxiliary.m_normal.m_pixels;
+  const auto &depths = auxiliary.m_depth;
+
+  for (int column = 0; column < width; ++column) {
+    const size_t center = size_t(row) * width + column;
+    const double center_luminance = luminance(illumination[center]);
+
+    // A small blur of the variance keeps single noisy estimates from
+    // switching the filter off
+    double local_variance = 0.0;
+    double local_weight = 0.0;
+    for (int y = std::max(row - 1, 0); y <= std::min(row + 1, height - 1);
+         ++y) {
+      for (int x = std::max(column - 1, 0);
+           x <= std::min(column + 1, width - 1); ++x) {
+        local_variance += variance[size_t(y) * width + x];
+        local_weight += 1.0;
+      }
+    }
+    const double luminance_scale =
+        settings.m_luminance_sigma * std::sqrt(local_variance / local_weight) +
+        1e-6;
+
+    Color sum(0, 0, 0);
+    double variance_sum = 0.0;
+    double weight_sum = 0.0;
+    for (int dy = -2; dy <= 2; ++dy) {
+      const int y = row + dy * level.m_step;
+      if (y < 0 || y >= height) {
+        continue;
+      }
+      for (int dx = -2; dx <= 2; ++dx) {
+        const int x = column + dx * level.m_step;
+        if (x < 0 || x >= width) {
+          continue;
+        }
+        const size_t other = size_t(y) * width + x;
+
+        const double luminance_distance =
+            std::fabs(luminance(illumination[other]) - center_luminance) /
+            luminance_scale;
+        const double depth_distance =
+            std::fabs(depths[center] - depths[other]) /
+            (settings.m_depth_sigma * std::max(depths[center], 1e-3) *
+             level.m_step);
+
+        const double weight =
+            kernel[dx + 2] * kernel[dy + 2] *
+            std::exp(-luminance_distance - depth_distance) *
+            normal_weight(normals[center], normals[other],
+                          settings.m_normal_exponent);
+        sum += weight * illumination[other];
+        variance_sum += weight * weight * variance[other];
+        weight_sum += weight;
+      }
+    }
+
+    // The center always has a weight of at least its kernel value
+    level.m_output->m_illumination[center] = sum / weight_sum;
+    level.m_output->m_variance[center] =
+        variance_sum / (weight_sum * weight_sum);
+  }
+}
+
+} // namespace
+
+FloatImage denoise(const FloatImage &color, const AuxiliaryBuffers &auxiliary,
+                   const DenoiseSettings &settings, ThreadPool &thread_pool) {
+  const size_t num_pixels = color.m_pixels.size();
+  Signal current{std::vector<Color>(num_pixels),
+                 std::vector<double>(num_pixels)};
+  for (size_t index = 0; index < num_pixels; ++index) {
+    const Color &albedo = auxiliary.m_albedo.m_pixels[index];
+    current.m_illumination[index] =
+        demodulate(color.m_pixels[index], albedo);
+    const double albedo_luminance = luminance(albedo) + albedo_epsilon;
+    current.m_variance[index] =
+        auxiliary.m_variance[index] / (albedo_luminance * albedo_luminance);
+  }
+  Signal next = current;
+
+  for (unsigned int iteration = 0; iteration < settings.m_iterations;
+       ++iteration) {
+    const Level level{&current, &next, 1 << iteration};
+    for (unsigned int row = 0; row < color.m_height; ++row) {
+      thread_pool.add_job([row, level, &auxiliary, &settings] {
+        filter_row(int(row), level, auxiliary, settings);
+      });
+    }
+    thread_pool.wait_for_empty_job_queue();
+    std::swap(current, next);
+  }
+
+  FloatImage result{color.m_width, color.m_height,
+                    std::move(current.m_illumination)};
+  for (size_t index = 0; index < num_pixels; ++index) {
+    const Color &albedo = auxiliary.m_albedo.m_pixels[index];
+    result.m_pixels[index] =
+        result.m_pixels[index] *
+        (albedo + Color(albedo_epsilon, albedo_epsilon, albedo_epsilon));
+  }
+  return result;
+}
+
+bool write_auxiliary_buffers(const std::string &prefix,
+                             const AuxiliaryBuffers &auxiliary) {
+  FloatImage depth{auxiliary.m_albedo.m_width, auxiliary.m_albedo.m_height,
+                   {}};
+  depth.m_pixels.reserve(auxiliary.m_depth.size());
+  for (const auto value : auxiliary.m_depth) {
+    depth.m_pixels.emplace_back(value, value, value);
+  }
+  return write_pfm(prefix + "_albedo.pfm", auxiliary.m_albedo) &&
+         write_pfm(prefix + "_normal.pfm", auxiliary.m_normal) &&
+         write_pfm(prefix + "_depth.pfm", depth);
+}
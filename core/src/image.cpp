@@ -0,0 +1,143 @@
+#include <image.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+
+namespace {
+
+bool is_little_endian() {
+  const std::uint16_t value = 1;
+  std::uint8_t first_byte;
+  std::memcpy(&first_byte, &value, 1);
+  return first_byte == 1;
+}
+
+float swap_bytes(const float value) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  bits = ((bits & 0x000000ffu) << 24) | ((bits & 0x0000ff00u) << 8) |
+         ((bits & 0x00ff0000u) >> 8) | ((bits & 0xff000000u) >> 24);
+  float swapped;
+  std::memcpy(&swapped, &bits, sizeof(swapped));
+  return swapped;
+}
+
+void check_same_size(const FloatImage &image, const FloatImage &reference) {
+  if (image.m_width != reference.m_width ||
+      image.m_height != reference.m_height ||
+      image.m_pixels.size() != reference.m_pixels.size()) {
+    throw std::invalid_argument("Image and reference differ in size");
+  }
+}
+
+} // namespace
+
+void write_ppm(std::ostream &out, const FloatImage &image) {
+  out << "P3\n" << image.m_width << " " << image.m_height << "\n255\n";
+  for (const auto &pixel : image.m_pixels) {
+    write_color(out, pixel);
+  }
+}
+
+bool write_pfm(const std::string &path, const FloatImage &image) {
+  std::ofstream out(path, std::ios::binary);
+  if (!out) {
+    return false;
+  }
+
+  // A negative scale marks the data as little endian
+  out << "PF\n"
+      << image.m_width << " " << image.m_height << "\n"
+      << (is_little_endian() ? "-1.0" : "1.0") << "\n";
+
+  // PFM scanlines run from the bottom of the image to the top
+  std::vector<float> scanline(3 * image.m_width);
+  for (unsigned int row = image.m_height; row-- > 0;) {
+    for (unsigned int column = 0; column < image.m_width; ++column) {
+      const auto &pixel = image.m_pixels[row * image.m_width + column];
+      scanline[3 * column + 0] = float(pixel.x());
+      scanline[3 * column + 1] = float(pixel.y());
+      scanline[3 * column + 2] = float(pixel.z());
+    }
+    out.write(reinterpret_cast<const char *>(scanline.data()),
+              scanline.size() * sizeof(float));
+  }
+  return bool(out);
+}
+
+bool read_pfm(const std::string &path, FloatImage &image) {
+  std::ifstream in(path, std::ios::binary);
+  std::string magic;
+  unsigned int width;
+  unsigned int height;
+  double scale;
+  if (!(in >> magic >> width >> height >> scale) || magic != "PF") {
+    return false;
+  }
+  in.get();
+
+  // The header can ask for any size, only allocate what the file holds
+  const auto data_start = in.tellg();
+  in.seekg(0, std::ios::end);
+  if (!in || in.tellg() - data_start !=
+                 std::streamoff(size_t(width) * height * 3 * sizeof(float))) {
+    return false;
+  }
+  in.seekg(data_start);
+
+  const bool needs_swap = (scale < 0) != is_little_endian();
+
+  image.m_width = width;
+  image.m_height = height;
+  image.m_pixels.assign(size_t(width) * height, Color(0, 0, 0));
+
+  std::vector<float> scanline(3 * width);
+  for (unsigned int row = height; row-- > 0;) {
+    if (!in.read(reinterpret_cast<char *>(scanline.data()),
+                 scanline.size() * sizeof(float))) {
+      return false;
+    }
+    for (auto &value : scanline) {
+      value = needs_swap ? swap_bytes(value) : value;
+    }
+    for (unsigned int column = 0; column < width; ++column) {
+      image.m_pixels[row * width + column] =
+          Color(scanline[3 * column + 0], scanline[3 * column + 1],
+                scanline[3 * column + 2]);
+    }
+  }
+  return true;
+}
+
+double root_mean_squared_error(const FloatImage &image,
+                               const FloatImage &reference) {
+  check_same_size(image, reference);
+  double sum = 0.0;
+  for (size_t index = 0; index < image.m_pixels.size(); ++index) {
+    sum += (image.m_pixels[index] - reference.m_pixels[index]).length_squared();
+  }
+  return std::sqrt(sum / (3.0 * image.m_pixels.size()));
+}
+
+double relative_mean_squared_error(const FloatImage &image,
+                                   const FloatImage &reference) {
+  // Keeps black reference pixels from dominating the average
+  constexpr double epsilon = 1e-2;
+  check_same_size(image, reference);
+
+  double sum = 0.0;
+  for (size_t index = 0; index < image.m_pixels.size(); ++index) {
+    const auto &value = image.m_pixels[index];
+    const auto &expected = reference.m_pixels[index];
+    for (int channel = 0; channel < 3; ++channel) {
+      const double error = value[channel] - expected[channel];
+      sum += error * error /
+             (expected[channel] * expected[channel] + epsilon);
+    }
+  }
+  return sum / (3.0 * image.m_pixels.size());
+}
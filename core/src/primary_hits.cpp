@@ -0,0 +1,110 @@
+#include <primary_hits.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <utility>
+
+namespace {
+
+constexpr char primary_hits_magic[4] = {'R', 'T', 'P', 'H'};
+constexpr std::uint32_t primary_hits_version = 1;
+
+template <typename T> void write_value(std::ostream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> bool read_value(std::istream &in, T &value) {
+  return bool(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+} // namespace
+
+bool write_primary_hits(const std::string &path,
+                        const PrimaryHitBuffer &buffer) {
+  const std::string temporary_path = path + ".tmp";
+  {
+    std::ofstream out(temporary_path, std::ios::binary);
+    out.write(primary_hits_magic, sizeof(primary_hits_magic));
+    write_value(out, primary_hits_version);
+    write_value(out, buffer.m_configuration_hash);
+    write_value(out, buffer.m_sample_seed);
+    write_value(out, buffer.m_width);
+    write_value(out, buffer.m_height);
+    write_value(out, buffer.m_samples_per_pixel);
+    out.write(reinterpret_cast<const char *>(buffer.m_hits.data()),
+              buffer.m_hits.size() * sizeof(PrimaryHit));
+    if (!out) {
+      return false;
+    }
+  }
+  return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+}
+
+bool read_primary_hits(const std::string &path,
+                       const PrimaryHitBuffer &expected,
+                       PrimaryHitBuffer &buffer) {
+  buffer = PrimaryHitBuffer{};
+
+  std::ifstream in(path, std::ios::binary);
+  char magic[sizeof(primary_hits_magic)];
+  std::uint32_t version;
+  if (!in.read(magic, sizeof(magic)) ||
+      !std::equal(magic, magic + sizeof(magic), primary_hits_magic) ||
+      !read_value(in, version) || version != primary_hits_version) {
+    return false;
+  }
+
+  PrimaryHitBuffer header;
+  if (!read_value(in, header.m_configuration_hash) ||
+      !read_value(in, header.m_sample_seed) ||
+      !read_value(in, header.m_width) || !read_value(in, header.m_height) ||
+      !read_value(in, header.m_samples_per_pixel)) {
+    return false;
+  }
+  if (header.m_configuration_hash != expected.m_configuration_hash ||
+      header.m_width != expected.m_width ||
+      header.m_height != expected.m_height ||
+      header.m_samples_per_pixel != expected.m_samples_per_pixel) {
+    return false;
+  }
+
+  // The rest of the file has to be exactly the hits
+  const size_t num_hits =
+      size_t(header.m_width) * header.m_height * header.m_samples_per_pixel;
+  const auto hits_start = in.tellg();
+  in.seekg(0, std::ios::end);
+  if (!in || in.tellg() - hits_start !=
+                 std::streamoff(num_hits * sizeof(PrimaryHit))) {
+    return false;
+  }
+  in.seekg(hits_start);
+
+  header.m_hits.resize(num_hits);
+  if (!in.read(reinterpret_cast<char *>(header.m_hits.data()),
+               header.m_hits.size() * sizeof(PrimaryHit))) {
+    return false;
+  }
+  buffer = std::move(header);
+  return true;
+}
+
+PrimitiveTable::PrimitiveTable(const Hittable &world) {
+  std::vector<const Hittable *> primitives;
+  world.collect_primitives(primitives);
+
+  m_geometry_hash = 0xcbf29ce484222325ull;
+  for (const auto *primitive : primitives) {
+    if (primitive->material() == nullptr ||
+        m_primitives.size() == PrimaryHit::untracked) {
+      continue;
+    }
+    // A primitive held by two containers is listed once
+    if (m_indices.emplace(primitive, std::uint32_t(m_primitives.size()))
+            .second) {
+      m_primitives.push_back(primitive);
+      m_geometry_hash = RandomGenerator::mix_bits(m_geometry_hash ^
+                                                  primitive->geometry_hash());
+    }
+  }
+}
@@ -0,0 +1,146 @@
+#include <thread_placement.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+// Parses the kernel's "0-3,8-11" CPU list format
+std::vector<unsigned int> parse_cpu_list(const std::string &list) {
+  std::vector<unsigned int> cpus;
+  std::stringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    const auto dash = range.find('-');
+    try {
+      const unsigned int first = std::stoul(range.substr(0, dash));
+      const unsigned int last =
+          dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+      for (unsigned int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    } catch (const std::logic_error &) {
+    }
+  }
+  return cpus;
+}
+
+std::vector<unsigned int> allowed_cpus() {
+  std::vector<unsigned int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  if (cpus.empty()) {
+    cpus.push_back(0);
+  }
+  return cpus;
+}
+
+} // namespace
+
+unsigned int CpuTopology::num_cpus() const {
+  size_t count = 0;
+  for (const auto &cpus : m_node_cpus) {
+    count += cpus.size();
+  }
+  return (unsigned int)count;
+}
+
+unsigned int CpuTopology::node_of_cpu(const unsigned int cpu) const {
+  for (unsigned int node = 0; node < m_node_cpus.size(); ++node) {
+    const auto &cpus = m_node_cpus[node];
+    if (std::find(std::begin(cpus), std::end(cpus), cpu) != std::end(cpus)) {
+      return node;
+    }
+  }
+  return 0;
+}
+
+CpuTopology detect_cpu_topology() {
+  const auto allowed = allowed_cpus();
+
+  CpuTopology topology;
+  std::ifstream online("/sys/devices/system/node/online");
+  std::string node_list;
+  std::getline(online, node_list);
+  for (const auto node : parse_cpu_list(node_list)) {
+    std::ifstream cpu_list_file("/sys/devices/system/node/node" +
+                                std::to_string(node) + "/cpulist");
+    std::string cpu_list;
+    std::getline(cpu_list_file, cpu_list);
+
+    // Only the CPUs we may run on, taskset and cgroups can hide some
+    std::vector<unsigned int> cpus;
+    for (const auto cpu : parse_cpu_list(cpu_list)) {
+      if (std::find(std::begin(allowed), std::end(allowed), cpu) !=
+          std::end(allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+    if (!cpus.empty()) {
+      topology.m_node_cpus.push_back(std::move(cpus));
+    }
+  }
+
+  if (topology.m_node_cpus.empty()) {
+    topology.m_node_cpus.push_back(allowed);
+  }
+  return topology;
+}
+
+std::vector<unsigned int> assign_cpus(const CpuTopology &topology,
+                                      const ThreadPlacement placement,
+                                      const unsigned int num_threads) {
+  std::vector<unsigned int> order;
+  if (placement == ThreadPlacement::Scatter) {
+    for (size_t index = 0; order.size() < topology.num_cpus(); ++index) {
+      for (const auto &cpus : topology.m_node_cpus) {
+        if (index < cpus.size()) {
+          order.push_back(cpus[index]);
+        }
+      }
+    }
+  } else {
+    for (const auto &cpus : topology.m_node_cpus) {
+      order.insert(std::end(order), std::begin(cpus), std::end(cpus));
+    }
+  }
+
+  std::vector<unsigned int> assigned(num_threads);
+  for (unsigned int thread = 0; thread < num_threads; ++thread) {
+    assigned[thread] = order[thread % order.size()];
+  }
+  return assigned;
+}
+
+bool pin_current_thread(const unsigned int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+void release_pages(void *data, const size_t bytes) {
+  const auto page_size = std::uintptr_t(sysconf(_SC_PAGESIZE));
+  const auto begin = std::uintptr_t(data);
+  const auto first_page = (begin + page_size - 1) & ~(page_size - 1);
+  const auto last_page = (begin + bytes) & ~(page_size - 1);
+  if (last_page > first_page) {
+    madvise(reinterpret_cast<void *>(first_page), last_page - first_page,
+            MADV_DONTNEED);
+  }
+}
@@ -0,0 +1,93 @@
+#include <tracer.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <ostream>
+
+void Tracer::start(const size_t events_per_thread) {
+  std::unique_lock<std::mutex> lock(m_buffers_mutex);
+  m_events_per_thread = std::max<size_t>(events_per_thread, 1);
+  m_buffers.clear();
+  ++m_generation;
+  m_start = std::chrono::steady_clock::now();
+  m_enabled.store(true, std::memory_order_relaxed);
+}
+
+Tracer::ThreadBuffer &Tracer::thread_buffer() {
+  thread_local ThreadBuffer *buffer = nullptr;
+  thread_local unsigned int generation = 0;
+  if (buffer == nullptr || generation != m_generation) {
+    std::unique_lock<std::mutex> lock(m_buffers_mutex);
+    m_buffers.push_back(std::make_unique<ThreadBuffer>());
+    buffer = m_buffers.back().get();
+    buffer->m_thread_id = (unsigned int)m_buffers.size();
+    buffer->m_events.reserve(m_events_per_thread);
+    generation = m_generation;
+  }
+  return *buffer;
+}
+
+void Tracer::record(const TraceEvent &event) {
+  auto &buffer = thread_buffer();
+  if (buffer.m_events.size() < m_events_per_thread) {
+    buffer.m_events.push_back(event);
+  } else {
+    buffer.m_events[buffer.m_next % m_events_per_thread] = event;
+  }
+  ++buffer.m_next;
+}
+
+void Tracer::set_thread_name(const std::string &name) {
+  if (is_enabled()) {
+    thread_buffer().m_name = name;
+  }
+}
+
+void Tracer::write_chrome_trace(std::ostream &out) const {
+  std::unique_lock<std::mutex> lock(m_buffers_mutex);
+
+  // Microseconds, with the nanoseconds after the point
+  const auto write_microseconds = [&out](const std::uint64_t ns) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%llu.%03llu",
+                  (unsigned long long)(ns / 1000),
+                  (unsigned long long)(ns % 1000));
+    out << text;
+  };
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool is_first = true;
+  const auto separate = [&] {
+    out << (is_first ? "\n" : ",\n");
+    is_first = false;
+  };
+
+  for (const auto &buffer : m_buffers) {
+    if (!buffer->m_name.empty()) {
+      separate();
+      out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+          << buffer->m_thread_id << ",\"args\":{\"name\":\"" << buffer->m_name
+          << "\"}}";
+    }
+
+    // Oldest first, once the ring has wrapped that is the next slot
+    const size_t num_events = buffer->m_events.size();
+    const size_t oldest = buffer->m_next - num_events;
+    for (size_t index = 0; index < num_events; ++index) {
+      const auto &event =
+          buffer->m_events[(oldest + index) % m_events_per_thread];
+      separate();
+      out << "{\"name\":\"" << event.m_name << "\",\"cat\":\""
+          << event.m_category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+          << buffer->m_thread_id << ",\"ts\":";
+      write_microseconds(event.m_begin_ns);
+      out << ",\"dur\":";
+      write_microseconds(event.m_end_ns - event.m_begin_ns);
+      if (event.m_argument >= 0) {
+        out << ",\"args\":{\"value\":" << event.m_argument << "}";
+      }
+      out << "}";
+    }
+  }
+  out << "\n]}\n";
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <options.hpp>
+#include <rt.hpp>
+
+#include <iosfwd>
+
+// Renders the scene at 1, 2, 4, ... samples per pixel and writes one CSV row
+// per budget with the render time and the error against a high spp reference.
+// The reference is rendered and stored on first use. Returns false if the
+// reference can't be read or written.
+bool run_convergence_benchmark(const SceneDescription &scene,
+                               const Options &options, std::ostream &out);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <options.hpp>
+#include <rt.hpp>
+
+#include <iosfwd>
+
+// Listens on the coordinator address, splits the frame into tiles of rows and
+// hands them to the worker processes that connect, keeping a couple of tiles
+// in flight per worker. The tiles of a worker that disconnects are given to
+// the others, and so is any tile that isn't back within
+// options.m_tile_timeout seconds. Writes the merged image to out once every
+// row has arrived.
+bool run_coordinator(const SceneDescription &scene, const Options &options,
+                     std::ostream &out);
+
+// Connects to the coordinator, builds the scene it names and renders tiles
+// with the local thread pool until told to shut down
+bool run_worker(const Options &options);
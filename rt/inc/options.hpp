@@ -0,0 +1,110 @@
+#pragma once
+
+#include <camera.hpp>
+#include <scene_generator.hpp>
+#include <thread_placement.hpp>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct Options {
+  std::string m_scene_name = "checkered_spheres";
+  // Zero means use the scene's own setting
+  unsigned int m_image_width = 0;
+  unsigned int m_samples_per_pixel = 0;
+  RenderMode m_render_mode = RenderMode::Shaded;
+  // Sample the scene's lights at every diffuse hit
+  bool m_light_sampling = true;
+  bool m_denoise = false;
+  // Trace secondary rays in sorted batches, see Camera::set_sort_rays
+  bool m_sort_rays = false;
+  // Empty for none, otherwise where the albedo, normal and depth PFMs go
+  std::string m_auxiliary_prefix;
+  // Empty for none, otherwise the file the primary hits are recorded to
+  // and replayed from, see Camera::set_primary_hits
+  std::string m_primary_hits_path;
+
+  // Zero leaves one core for the main thread and uses the rest
+  unsigned int m_num_threads = 0;
+  ThreadPlacement m_thread_placement = ThreadPlacement::None;
+  // Build one copy of the scene on every NUMA node, needs pinned threads
+  bool m_replicate_scene = false;
+
+  // Progressive rendering, enabled by a non-zero time budget
+  double m_time_budget_seconds = 0;
+  unsigned int m_samples_per_pass = 1;
+  double m_snapshot_interval_seconds = 0;
+  std::string m_snapshot_path = "snapshot.ppm";
+
+  // Checkpoints of a progressive render, a path alone enables progressive
+  // rendering without a time budget
+  std::string m_checkpoint_path;
+  double m_checkpoint_interval_seconds = 60;
+  bool m_resume = false;
+
+  // Animation sequences, enabled by a frame count
+  unsigned int m_frames = 0;
+  double m_frame_rate = 24;
+  // Fraction of the frame the shutter is open for, sets the motion blur
+  double m_shutter = 0.5;
+  std::string m_frame_pattern = "frame_%04d.ppm";
+  // Rebuild the BVH once refitting has grown its nodes' area by this factor
+  double m_rebuild_threshold = 1.5;
+
+  // Distributed rendering over Unix or TCP sockets
+  std::string m_coordinator_address;
+  std::string m_worker_address;
+  unsigned int m_spawn_workers = 0;
+  unsigned int m_tile_rows = 16;
+  // Seconds before a tile that hasn't come back is handed out again
+  unsigned int m_tile_timeout = 300;
+  // argv[0], used to start local workers
+  std::string m_program_path;
+
+  // Convergence benchmark
+  bool m_convergence = false;
+  std::string m_reference_directory = "references";
+  unsigned int m_reference_samples_per_pixel = 4096;
+  unsigned int m_max_samples_per_pixel = 256;
+
+  // Thread scaling benchmark
+  bool m_scaling = false;
+
+  // Scene size and thread scaling benchmark over generated spheres
+  bool m_scene_scaling = false;
+  std::vector<size_t> m_scene_sizes = {1000, 10000, 100000, 1000000};
+  std::vector<SphereDistribution> m_scene_distributions = {
+      SphereDistribution::Uniform, SphereDistribution::Clustered,
+      SphereDistribution::Overlapping};
+  // Builds the deeper levels of the tree as rays first reach them
+  bool m_lazy_bvh = false;
+  // Traces a tree with 8 bit child bounds instead of the full precision one
+  bool m_compressed_bvh = false;
+
+  // Empty for none, otherwise where the Chrome trace of the run goes
+  std::string m_trace_path;
+
+  // Render server, "-" for standard input
+  std::string m_serve_address;
+  unsigned int m_scene_cache_size = 4;
+  // Moves the scene's camera when set, only render server jobs set these
+  std::optional<Point3> m_look_from;
+  std::optional<Point3> m_look_at;
+  // Zero keeps the scene's
+  double m_vertical_field_of_view = 0;
+};
+
+// Throws std::invalid_argument on anything it doesn't understand
+Options parse_options(int argc, char **argv);
+
+// The parsers behind parse_options, for other places that take the same
+// values. All throw std::invalid_argument naming the flag.
+unsigned int parse_unsigned(const std::string &flag, const std::string &value);
+// Three comma separated numbers, like 13,2,3
+Point3 parse_point(const std::string &flag, const std::string &value);
+// Degrees, more than 0 and less than 180
+double parse_field_of_view(const std::string &flag, const std::string &value);
+
+std::string usage(const std::string &program);
@@ -1,11 +1,67 @@
 #pragma once
 
+#include <camera.hpp>
 #include <color.hpp>
 #include <constants.hpp>
+#include <hittable_list.hpp>
 #include <interval.hpp>
+#include <light_list.hpp>
+#include <options.hpp>
 #include <ray.hpp>
 #include <vec3.hpp>
 
-void many_balls_scene();
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
-void checkered_spheres();
+// The primitives of an animated scene and a function that moves them to
+// where they are over the shutter interval of a frame, in seconds
+struct AnimatedWorld {
+  std::vector<std::shared_ptr<Hittable>> m_objects;
+  std::function<void(double time_begin, double time_end)> m_animate;
+};
+
+struct SceneDescription {
+  std::string m_name;
+  unsigned int m_image_width;
+  unsigned int m_samples_per_pixel;
+  std::function<HittableList(void)> m_make_world;
+  std::function<Camera(unsigned int image_width,
+                       unsigned int samples_per_pixel)>
+      m_make_camera;
+  // Only set for scenes that can be rendered as a sequence
+  std::function<AnimatedWorld(void)> m_make_animated_world = {};
+  // Only set for scenes with emissive objects worth sampling directly
+  std::function<LightList(void)> m_make_lights = {};
+};
+
+const std::vector<SceneDescription> &built_in_scenes();
+
+// Returns nullptr when there is no scene with that name
+const SceneDescription *find_scene(const std::string &name);
+
+// Builds the world from a fixed seed, so it is identical on every run
+HittableList make_world(const SceneDescription &scene);
+
+// Like make_world, but with --replicate-scene one copy is built on each NUMA
+// node and every pinned thread traverses its own node's copy
+HittableList make_world(const SceneDescription &scene, const Options &options);
+
+// Like make_world, for the scenes that have an animation
+AnimatedWorld make_animated_world(const SceneDescription &scene);
+
+// Empty for scenes without emitters
+LightList make_lights(const SceneDescription &scene);
+
+// Stable across runs and processes, for tagging checkpoints and caches.
+// Covers the scene's name and the geometry of the world built from it,
+// materials and textures are not included.
+std::uint64_t scene_hash(const SceneDescription &scene, const Hittable &world);
+
+// Uses the scene defaults for anything the options leave unset, and gives
+// the camera the scene's lights unless light sampling is turned off
+Camera make_camera(const SceneDescription &scene, const Options &options);
+
+void render_scene(const SceneDescription &scene, const Options &options);
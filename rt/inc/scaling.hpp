@@ -0,0 +1,21 @@
+#pragma once
+
+#include <options.hpp>
+#include <rt.hpp>
+
+#include <iosfwd>
+
+// Renders the scene with 1, 2, 4, ... threads up to every CPU the process may
+// run on and writes one CSV row per thread count with the render time, the
+// speedup over one thread and the parallel efficiency
+bool run_scaling_benchmark(const SceneDescription &scene,
+                           const Options &options, std::ostream &out);
+
+// For every distribution and size in the options, generates that many
+// spheres, builds a BVH over them, eagerly or lazily, and renders a narrow
+// view from one corner to find the time to the first pixel. Then traces the
+// same incoherent rays with 1, 2, 4, ... threads. Writes one CSV row per
+// thread count with the build time, the time to the first pixel, how much of
+// the tree the view needed, the memory per sphere, the ray rate and the
+// parallel efficiency.
+bool run_scene_scaling_benchmark(const Options &options, std::ostream &out);
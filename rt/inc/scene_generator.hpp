@@ -0,0 +1,32 @@
+#pragma once
+
+#include <hittable.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+enum class SphereDistribution {
+  // Spread evenly through the volume
+  Uniform,
+  // Dense clumps of about a thousand small spheres, with empty space between
+  Clustered,
+  // Evenly spread but so large that each one overlaps about a hundred others
+  Overlapping,
+};
+
+std::string to_string(SphereDistribution distribution);
+
+// Empty for names it doesn't know
+std::optional<SphereDistribution>
+parse_sphere_distribution(const std::string &name);
+
+// num_spheres spheres in a cube that grows with their number, so that the
+// density stays the same at any size. They share a handful of materials.
+// Each sphere and its share of a tree take some 300 to 550 bytes, so ten
+// million is about the most that fits in a few GB.
+// Seeded, so the same arguments always give the same scene.
+std::vector<std::shared_ptr<Hittable>>
+generate_spheres(size_t num_spheres, SphereDistribution distribution);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <options.hpp>
+#include <rt.hpp>
+
+#include <optional>
+#include <string>
+
+// The pattern with its single %d or %0Nd replaced by the frame number, or
+// nothing if the pattern has any other number of conversions or any other %
+std::optional<std::string> format_frame_path(const std::string &pattern,
+                                             unsigned int frame);
+
+// Renders the frames of an animated scene in one process. One camera and its
+// worker threads serve every frame, and the BVH is refitted to the moved
+// primitives instead of rebuilt, unless refitting has let its nodes' surface
+// areas grow past the rebuild threshold. Returns false if the scene has no
+// animation or a frame can't be written.
+bool render_sequence(const SceneDescription &scene, const Options &options);
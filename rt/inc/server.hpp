@@ -0,0 +1,20 @@
+#pragma once
+
+#include <options.hpp>
+
+// Serves render jobs until told to quit, from a Unix or TCP socket or from
+// standard input when the address is "-". A job is one line of key=value
+// pairs:
+//
+//   scene=many_balls width=400 spp=64 output=balls.ppm
+//
+// with optional denoise=1, light_sampling=0 and a view of look_from=X,Y,Z,
+// look_at=X,Y,Z and vfov=DEGREES that moves the scene's camera, anything else
+// comes from the server's own options. Each job is answered with one line,
+// "ok OUTPUT SECONDS" once the image is written or "error MESSAGE". The line
+// "quit" stops the server.
+//
+// Built worlds stay in an LRU cache of options.m_scene_cache_size scenes and
+// all jobs render on one pool of threads that is started once, so a job for
+// a cached scene only pays for rendering. Returns false on setup errors.
+bool run_server(const Options &options);
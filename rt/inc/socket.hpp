@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Stream socket over either a Unix domain path or TCP. Addresses are written
+// as "unix:/path/to/socket" or "tcp:host:port". Failures throw
+// std::runtime_error.
+class Socket {
+public:
+  Socket() {}
+
+  explicit Socket(const int file_descriptor)
+      : m_file_descriptor(file_descriptor) {}
+
+  Socket(Socket &&other)
+      : m_file_descriptor(other.m_file_descriptor) {
+    other.m_file_descriptor = -1;
+  }
+
+  Socket &operator=(Socket &&other) {
+    if (this != &other) {
+      close();
+      m_file_descriptor = other.m_file_descriptor;
+      other.m_file_descriptor = -1;
+    }
+    return *this;
+  }
+
+  Socket(const Socket &) = delete;
+  Socket &operator=(const Socket &) = delete;
+
+  ~Socket() { close(); }
+
+  static Socket listen(const std::string &address);
+  static Socket connect(const std::string &address);
+
+  Socket accept() const;
+
+  int file_descriptor() const { return m_file_descriptor; }
+  bool is_open() const { return m_file_descriptor >= 0; }
+  void close();
+
+  void send_all(const void *data, size_t size) const;
+  // Returns false if the peer closed the connection first
+  bool receive_all(void *data, size_t size) const;
+  // Returns the number of bytes read, zero once the peer has closed
+  size_t receive_some(void *data, size_t size) const;
+
+private:
+  int m_file_descriptor = -1;
+};
+
+enum class MessageType : std::uint32_t {
+  Job = 1,
+  Tile = 2,
+  TileResult = 3,
+  Shutdown = 4,
+};
+
+struct Message {
+  MessageType m_type;
+  std::vector<char> m_payload;
+};
+
+void send_message(const Socket &socket, const MessageType type,
+                  const std::vector<char> &payload = {});
+
+// Blocks for the next message, returns false if the peer closed
+bool receive_message(const Socket &socket, Message &message);
+
+// Decodes messages from whatever bytes have arrived so far, for use with
+// poll() where a read may stop in the middle of a message
+class MessageReader {
+public:
+  // Returns false once the peer has closed the connection
+  bool read_available(const Socket &socket);
+  bool next(Message &message);
+
+private:
+  std::vector<char> m_buffer;
+};
+
+// Fixed width fields for building and parsing message payloads
+void append_u32(std::vector<char> &payload, std::uint32_t value);
+void append_string(std::vector<char> &payload, const std::string &value);
+std::uint32_t read_u32(const std::vector<char> &payload, size_t &offset);
+std::string read_string(const std::vector<char> &payload, size_t &offset);
@@ -0,0 +1,112 @@
+#include <convergence.hpp>
+
+#include <camera.hpp>
+#include <hittable_list.hpp>
+#include <image.hpp>
+
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+constexpr unsigned int default_convergence_width = 320;
+
+// The name holds a hash of the camera and the world's geometry, so a
+// reference rendered before the scene changed is rendered again instead of
+// being measured against
+std::string reference_path(const SceneDescription &scene,
+                           const Options &options, const Camera &camera,
+                           const Hittable &world) {
+  const std::uint64_t hash = RandomGenerator::mix_bits(
+      scene_hash(scene, world) ^ camera.configuration_hash());
+
+  std::ostringstream name;
+  name << scene.m_name << "_" << camera.image_width() << "x"
+       << camera.image_height() << "_" << camera.samples_per_pixel() << "spp_"
+       << std::hex << std::setw(16) << std::setfill('0') << hash << ".pfm";
+  return (std::filesystem::path(options.m_reference_directory) / name.str())
+      .string();
+}
+
+bool load_or_render_reference(const SceneDescription &scene,
+                              const Options &options, const Hittable &world,
+                              const unsigned int image_width,
+                              FloatImage &reference) {
+  Options reference_options = options;
+  reference_options.m_image_width = image_width;
+  reference_options.m_samples_per_pixel = options.m_reference_samples_per_pixel;
+  // The reference has to be the converged estimate, not a filtered one
+  reference_options.m_denoise = false;
+  Camera camera = make_camera(scene, reference_options);
+  const auto path = reference_path(scene, options, camera, world);
+
+  if (read_pfm(path, reference) &&
+      reference.m_width == camera.image_width() &&
+      reference.m_height == camera.image_height()) {
+    std::clog << "Using reference " << path << std::endl;
+    return true;
+  }
+
+  std::clog << "Rendering reference " << path << std::endl;
+  camera.render_image(world);
+  reference = camera.float_image();
+
+  std::error_code error;
+  std::filesystem::create_directories(options.m_reference_directory, error);
+  if (!write_pfm(path, reference)) {
+    std::cerr << "Could not write reference " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+bool run_convergence_benchmark(const SceneDescription &scene,
+                               const Options &options, std::ostream &out) {
+  const unsigned int image_width = options.m_image_width
+                                       ? options.m_image_width
+                                       : default_convergence_width;
+
+  const HittableList world = make_world(scene);
+
+  FloatImage reference;
+  if (!load_or_render_reference(scene, options, world, image_width,
+                                reference)) {
+    return false;
+  }
+
+  out << "scene,width,height,spp,seconds,rmse,relmse,efficiency\n";
+
+  for (unsigned int samples_per_pixel = 1;
+       samples_per_pixel <= options.m_max_samples_per_pixel;
+       samples_per_pixel *= 2) {
+    Options sample_options = options;
+    sample_options.m_image_width = image_width;
+    sample_options.m_samples_per_pixel = samples_per_pixel;
+    Camera camera = make_camera(scene, sample_options);
+
+    const auto start = std::chrono::steady_clock::now();
+    camera.render_image(world);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    const FloatImage image = camera.float_image();
+    const double rmse = root_mean_squared_error(image, reference);
+    const double relmse = relative_mean_squared_error(image, reference);
+
+    // Inverse of error times cost, higher is better and independent of spp
+    // for an unbiased estimator
+    const double efficiency = 1.0 / (relmse * elapsed.count());
+
+    out << scene.m_name << "," << image.m_width << "," << image.m_height << ","
+        << samples_per_pixel << "," << elapsed.count() << "," << rmse << ","
+        << relmse << "," << efficiency << std::endl;
+  }
+
+  return true;
+}
@@ -0,0 +1,388 @@
+#include <distributed.hpp>
+
+#include <camera.hpp>
+#include <hittable_list.hpp>
+#include <image.hpp>
+#include <socket.hpp>
+#include <thread_pool.hpp>
+#include <tracer.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <string>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// Tiles in flight per worker, the second one hides the round trip
+constexpr size_t tiles_in_flight = 2;
+
+// How long the coordinator waits without a single worker before it gives up
+constexpr std::chrono::seconds worker_timeout(60);
+
+struct TileRange {
+  unsigned int m_row_begin;
+  unsigned int m_row_end;
+};
+
+// A tile handed to a worker. Once its deadline passes it also goes back on
+// the queue for someone else, but stays here in case the worker still
+// delivers it.
+struct InFlightTile {
+  TileRange m_range;
+  std::chrono::steady_clock::time_point m_deadline;
+  bool m_is_requeued = false;
+};
+
+struct WorkerConnection {
+  Socket m_socket;
+  MessageReader m_reader;
+  std::vector<InFlightTile> m_in_flight;
+};
+
+// The threads each local worker runs, --threads if given and otherwise an
+// equal share of the cores
+unsigned int local_worker_threads(const Options &options) {
+  if (options.m_num_threads > 0) {
+    return options.m_num_threads;
+  }
+  return std::max(1u, std::thread::hardware_concurrency() /
+                          std::max(1u, options.m_spawn_workers));
+}
+
+std::vector<pid_t> spawn_local_workers(const Options &options) {
+  const auto num_threads = std::to_string(local_worker_threads(options));
+  std::vector<pid_t> children;
+  for (unsigned int index = 0; index < options.m_spawn_workers; ++index) {
+    const pid_t child = ::fork();
+    if (child < 0) {
+      std::cerr << "Could not spawn worker " << index << std::endl;
+      continue;
+    }
+    if (child == 0) {
+      ::execlp(options.m_program_path.c_str(), options.m_program_path.c_str(),
+               "--worker", options.m_coordinator_address.c_str(), "--threads",
+               num_threads.c_str(), nullptr);
+      std::_Exit(127);
+    }
+    children.push_back(child);
+  }
+  return children;
+}
+
+void send_tile(WorkerConnection &worker, const TileRange &tile,
+               const std::chrono::seconds timeout) {
+  std::vector<char> payload;
+  append_u32(payload, tile.m_row_begin);
+  append_u32(payload, tile.m_row_end);
+  send_message(worker.m_socket, MessageType::Tile, payload);
+  worker.m_in_flight.push_back(
+      InFlightTile{tile, std::chrono::steady_clock::now() + timeout});
+}
+
+// Copies a finished tile into the image, returns false if it was not one
+// this worker had been given or does not hold the whole tile. Throws on a
+// truncated message.
+bool merge_tile_result(WorkerConnection &worker, const Message &message,
+                       FloatImage &image, std::vector<bool> &row_done,
+                       unsigned int &rows_done) {
+  size_t offset = 0;
+  const auto row_begin = read_u32(message.m_payload, offset);
+  const auto row_end = read_u32(message.m_payload, offset);
+
+  const auto tile = std::find_if(
+      std::begin(worker.m_in_flight), std::end(worker.m_in_flight),
+      [&](const InFlightTile &tile) {
+        return tile.m_range.m_row_begin == row_begin &&
+               tile.m_range.m_row_end == row_end;
+      });
+  if (tile == std::end(worker.m_in_flight)) {
+    return false;
+  }
+
+  // A bad reply leaves the tile in flight, to be handed out again when the
+  // worker is dropped
+  const size_t num_values = size_t(row_end - row_begin) * image.m_width * 3;
+  if (message.m_payload.size() != offset + num_values * sizeof(float)) {
+    return false;
+  }
+  worker.m_in_flight.erase(tile);
+  const float *values =
+      reinterpret_cast<const float *>(message.m_payload.data() + offset);
+
+  for (unsigned int row = row_begin; row < row_end; ++row) {
+    for (unsigned int column = 0; column < image.m_width; ++column) {
+      image.m_pixels[size_t(row) * image.m_width + column] =
+          Color(values[0], values[1], values[2]);
+      values += 3;
+    }
+    if (!row_done[row]) {
+      row_done[row] = true;
+      ++rows_done;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+bool run_coordinator(const SceneDescription &scene, const Options &options,
+                     std::ostream &out) {
+  const Camera camera = make_camera(scene, options);
+
+  FloatImage image{camera.image_width(), camera.image_height(),
+                   std::vector<Color>(size_t(camera.image_width()) *
+                                          camera.image_height(),
+                                      Color(0, 0, 0))};
+
+  std::deque<TileRange> pending;
+  for (unsigned int row = 0; row < image.m_height; row += options.m_tile_rows) {
+    pending.push_back(
+        TileRange{row, std::min(row + options.m_tile_rows, image.m_height)});
+  }
+
+  std::vector<char> job;
+  append_string(job, scene.m_name);
+  append_u32(job, camera.image_width());
+  append_u32(job, camera.samples_per_pixel());
+  append_u32(job, options.m_light_sampling);
+
+  const Socket listener = Socket::listen(options.m_coordinator_address);
+  std::clog << "Coordinator listening on " << options.m_coordinator_address
+            << ", " << pending.size() << " tiles" << std::endl;
+
+  const auto children = spawn_local_workers(options);
+
+  std::list<WorkerConnection> workers;
+  std::vector<bool> row_done(image.m_height, false);
+  unsigned int rows_done = 0;
+
+  const auto drop_worker = [&](std::list<WorkerConnection>::iterator worker) {
+    std::clog << "\nWorker lost, reassigning " << worker->m_in_flight.size()
+              << " tiles" << std::endl;
+    for (const auto &tile : worker->m_in_flight) {
+      if (!tile.m_is_requeued) {
+        pending.push_front(tile.m_range);
+      }
+    }
+    return workers.erase(worker);
+  };
+
+  // A worker that hangs but keeps its connection open would otherwise hold
+  // on to its tiles forever
+  const std::chrono::seconds tile_timeout(options.m_tile_timeout);
+  const auto requeue_late_tiles = [&] {
+    const auto now = std::chrono::steady_clock::now();
+    for (auto &worker : workers) {
+      for (auto &tile : worker.m_in_flight) {
+        if (!tile.m_is_requeued && now > tile.m_deadline &&
+            !row_done[tile.m_range.m_row_begin]) {
+          std::clog << "\nTile at row " << tile.m_range.m_row_begin
+                    << " is late, reassigning it" << std::endl;
+          tile.m_is_requeued = true;
+          pending.push_front(tile.m_range);
+        }
+      }
+    }
+  };
+
+  auto last_worker_seen = std::chrono::steady_clock::now();
+  bool has_timed_out = false;
+  while (rows_done < image.m_height) {
+    if (!workers.empty()) {
+      last_worker_seen = std::chrono::steady_clock::now();
+    } else if (std::chrono::steady_clock::now() - last_worker_seen >
+               worker_timeout) {
+      has_timed_out = true;
+      break;
+    }
+
+    std::vector<pollfd> descriptors{{listener.file_descriptor(), POLLIN, 0}};
+    for (const auto &worker : workers) {
+      descriptors.push_back({worker.m_socket.file_descriptor(), POLLIN, 0});
+    }
+
+    if (::poll(descriptors.data(), descriptors.size(), 1000) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("poll failed");
+    }
+
+    // A connection that fails on its way in is simply not added
+    if (descriptors[0].revents & POLLIN) {
+      try {
+        Socket socket = listener.accept();
+        send_message(socket, MessageType::Job, job);
+        workers.push_back(WorkerConnection{std::move(socket), {}, {}});
+      } catch (const std::runtime_error &) {
+      }
+    }
+
+    // New workers were appended after the descriptors were gathered, so the
+    // first descriptors.size() - 1 workers line up with the poll results
+    size_t descriptor_index = 1;
+    for (auto worker = std::begin(workers);
+         worker != std::end(workers) && descriptor_index < descriptors.size();
+         ++descriptor_index) {
+      const auto events = descriptors[descriptor_index].revents;
+      if (!(events & (POLLIN | POLLHUP | POLLERR))) {
+        ++worker;
+        continue;
+      }
+
+      // Anything the worker sends that can't be read or merged drops it,
+      // not the coordinator
+      bool is_alive = true;
+      try {
+        is_alive = worker->m_reader.read_available(worker->m_socket);
+        Message message;
+        while (is_alive && worker->m_reader.next(message)) {
+          is_alive = message.m_type == MessageType::TileResult &&
+                     merge_tile_result(*worker, message, image, row_done,
+                                       rows_done);
+        }
+      } catch (const std::runtime_error &) {
+        is_alive = false;
+      }
+
+      worker = is_alive ? std::next(worker) : drop_worker(worker);
+    }
+
+    requeue_late_tiles();
+
+    // Skip tiles that another worker has already delivered
+    while (!pending.empty() && row_done[pending.front().m_row_begin]) {
+      pending.pop_front();
+    }
+
+    for (auto worker = std::begin(workers); worker != std::end(workers);) {
+      try {
+        while (!pending.empty() &&
+               worker->m_in_flight.size() < tiles_in_flight) {
+          send_tile(*worker, pending.front(), tile_timeout);
+          pending.pop_front();
+        }
+        ++worker;
+      } catch (const std::runtime_error &) {
+        worker = drop_worker(worker);
+      }
+    }
+
+    std::clog << "\rRows: " << rows_done << " / " << image.m_height
+              << ", workers: " << workers.size() << "     " << std::flush;
+  }
+  std::clog << std::endl;
+
+  for (auto &worker : workers) {
+    try {
+      send_message(worker.m_socket, MessageType::Shutdown);
+    } catch (const std::runtime_error &) {
+    }
+  }
+  workers.clear();
+
+  for (const auto child : children) {
+    ::waitpid(child, nullptr, 0);
+  }
+
+  if (options.m_coordinator_address.rfind("unix:", 0) == 0) {
+    ::unlink(options.m_coordinator_address.substr(5).c_str());
+  }
+
+  if (has_timed_out) {
+    std::cerr << "No workers for " << worker_timeout.count() << "s with "
+              << image.m_height - rows_done << " rows left, giving up"
+              << std::endl;
+    return false;
+  }
+
+  write_ppm(out, image);
+  return true;
+}
+
+bool run_worker(const Options &options) {
+  // The coordinator may not be listening yet when the worker starts
+  Socket socket;
+  for (int attempt = 0;; ++attempt) {
+    try {
+      socket = Socket::connect(options.m_worker_address);
+      break;
+    } catch (const std::runtime_error &error) {
+      if (attempt == 100) {
+        std::cerr << error.what() << std::endl;
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+
+  Message message;
+  if (!receive_message(socket, message) || message.m_type != MessageType::Job) {
+    std::cerr << "Expected a job from the coordinator" << std::endl;
+    return false;
+  }
+
+  size_t offset = 0;
+  const auto scene_name = read_string(message.m_payload, offset);
+  Options job_options = options;
+  job_options.m_image_width = read_u32(message.m_payload, offset);
+  job_options.m_samples_per_pixel = read_u32(message.m_payload, offset);
+  job_options.m_light_sampling = read_u32(message.m_payload, offset) != 0;
+
+  const SceneDescription *scene = find_scene(scene_name);
+  if (scene == nullptr) {
+    std::cerr << "Unknown scene: " << scene_name << std::endl;
+    return false;
+  }
+
+  Camera camera = make_camera(*scene, job_options);
+  const HittableList world = make_world(*scene);
+
+  while (receive_message(socket, message)) {
+    if (message.m_type == MessageType::Shutdown) {
+      return true;
+    }
+    if (message.m_type != MessageType::Tile) {
+      std::cerr << "Unexpected message from the coordinator" << std::endl;
+      return false;
+    }
+
+    offset = 0;
+    const auto row_begin = read_u32(message.m_payload, offset);
+    const auto row_end = read_u32(message.m_payload, offset);
+    if (row_begin >= row_end || row_end > camera.image_height()) {
+      std::cerr << "Invalid tile " << row_begin << " to " << row_end
+                << " from the coordinator" << std::endl;
+      return false;
+    }
+    const TraceScope trace("tile", "distributed", row_begin);
+
+    const auto pixels = camera.render_rows(world, row_begin, row_end);
+
+    std::vector<char> result;
+    append_u32(result, row_begin);
+    append_u32(result, row_end);
+    result.reserve(result.size() + pixels.size() * 3 * sizeof(float));
+    for (const auto &pixel : pixels) {
+      const float values[3] = {float(pixel.x()), float(pixel.y()),
+                               float(pixel.z())};
+      const char *bytes = reinterpret_cast<const char *>(values);
+      result.insert(std::end(result), bytes, bytes + sizeof(values));
+    }
+    send_message(socket, MessageType::TileResult, result);
+  }
+
+  // The coordinator went away without saying goodbye
+  return false;
+}
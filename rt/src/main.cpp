@@ -1,16 +1,124 @@
-#include <camera.hpp>
-#include <hittable_list.hpp>
+#include <convergence.hpp>
+#include <distributed.hpp>
+#include <options.hpp>
 #include <rt.hpp>
+#include <scaling.hpp>
+#include <sequence.hpp>
+#include <server.hpp>
+#include <tracer.hpp>
+#include <traversal_stats.hpp>
 
-#include <memory>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
 
 // We draw the image from top left corner across and then down
 
-int main() {
+namespace {
 
-  // many_balls_scene();
+// Records the whole run when --trace is given and writes it on the way out
+class TraceFile {
+public:
+  explicit TraceFile(const std::string &path)
+      : m_path(path) {
+    if (m_path.empty()) {
+      return;
+    }
+    tracer().start(1 << 16);
+    tracer().set_thread_name("main");
+  }
 
-  checkered_spheres();
+  TraceFile(const TraceFile &) = delete;
+  TraceFile &operator=(const TraceFile &) = delete;
+
+  ~TraceFile() {
+    if (m_path.empty()) {
+      return;
+    }
+    tracer().stop();
+    std::ofstream out(m_path);
+    tracer().write_chrome_trace(out);
+    if (!out) {
+      std::cerr << "Could not write the trace to " << m_path << std::endl;
+    }
+  }
+
+private:
+  const std::string m_path;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+  Options options;
+  try {
+    options = parse_options(argc, argv);
+  } catch (const std::invalid_argument &error) {
+    std::cerr << error.what() << "\n" << usage(argv[0]);
+    return 1;
+  }
+
+  const TraceFile trace_file(options.m_trace_path);
+
+  try {
+    if (!options.m_worker_address.empty()) {
+      return run_worker(options) ? 0 : 1;
+    }
+  } catch (const std::runtime_error &error) {
+    std::cerr << "Worker: " << error.what() << std::endl;
+    return 1;
+  }
+
+  if (!options.m_serve_address.empty()) {
+    try {
+      return run_server(options) ? 0 : 1;
+    } catch (const std::runtime_error &error) {
+      std::cerr << "Server: " << error.what() << std::endl;
+      return 1;
+    }
+  }
+
+  // Generates its own scenes
+  if (options.m_scene_scaling) {
+    return run_scene_scaling_benchmark(options, std::cout) ? 0 : 1;
+  }
+
+  const SceneDescription *scene = find_scene(options.m_scene_name);
+  if (scene == nullptr) {
+    std::cerr << "Unknown scene: " << options.m_scene_name << "\n"
+              << usage(argv[0]);
+    return 1;
+  }
+
+  if (options.m_render_mode != RenderMode::Shaded &&
+      !traversal_stats_enabled) {
+    std::cerr << "--heatmap needs a build with -DRT_TRAVERSAL_STATS=ON\n";
+    return 1;
+  }
+
+  if (!options.m_coordinator_address.empty()) {
+    try {
+      return run_coordinator(*scene, options, std::cout) ? 0 : 1;
+    } catch (const std::runtime_error &error) {
+      std::cerr << "Coordinator: " << error.what() << std::endl;
+      return 1;
+    }
+  }
+
+  if (options.m_frames > 0) {
+    return render_sequence(*scene, options) ? 0 : 1;
+  }
+
+  if (options.m_convergence) {
+    return run_convergence_benchmark(*scene, options, std::cout) ? 0 : 1;
+  }
+
+  if (options.m_scaling) {
+    return run_scaling_benchmark(*scene, options, std::cout) ? 0 : 1;
+  }
+
+  render_scene(*scene, options);
 
   return 0;
 }
@@ -0,0 +1,378 @@
+#include <options.hpp>
+
+#include <sequence.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+double parse_seconds(const std::string &flag, const std::string &value) {
+  try {
+    size_t parsed_length = 0;
+    const auto parsed = std::stod(value, &parsed_length);
+    if (parsed_length == value.size() && parsed >= 0) {
+      return parsed;
+    }
+  } catch (const std::logic_error &) {
+  }
+  throw std::invalid_argument("Invalid value for " + flag + ": " + value);
+}
+
+std::vector<std::string> split_list(const std::string &list) {
+  std::vector<std::string> items;
+  size_t begin = 0;
+  for (;;) {
+    const auto end = list.find(',', begin);
+    items.push_back(list.substr(begin, end - begin));
+    if (end == std::string::npos) {
+      return items;
+    }
+    begin = end + 1;
+  }
+}
+
+// Whole numbers, also written like 1e6, up to a billion: far more than fits
+// in memory, and exactly representable in a double and a size_t
+size_t parse_count(const std::string &flag, const std::string &value) {
+  constexpr double max_count = 1e9;
+  try {
+    size_t parsed_length = 0;
+    const auto parsed = std::stod(value, &parsed_length);
+    if (parsed_length == value.size() && parsed >= 1 &&
+        parsed <= max_count && parsed == std::floor(parsed)) {
+      return size_t(parsed);
+    }
+  } catch (const std::logic_error &) {
+  }
+  throw std::invalid_argument("Invalid value for " + flag + ": " + value);
+}
+
+} // namespace
+
+// Digits only, std::stoul would also take a sign and wrap negative values
+unsigned int parse_unsigned(const std::string &flag, const std::string &value) {
+  try {
+    size_t parsed_length = 0;
+    const auto parsed =
+        value.empty() || value.front() < '0' || value.front() > '9'
+            ? 0
+            : std::stoull(value, &parsed_length);
+    if (parsed_length != 0 && parsed_length == value.size() &&
+        parsed <= std::numeric_limits<unsigned int>::max()) {
+      return (unsigned int)parsed;
+    }
+  } catch (const std::logic_error &) {
+  }
+  throw std::invalid_argument("Invalid value for " + flag + ": " + value);
+}
+
+Point3 parse_point(const std::string &flag, const std::string &value) {
+  const auto coordinates = split_list(value);
+  if (coordinates.size() == 3) {
+    try {
+      double parsed[3];
+      bool is_valid = true;
+      for (int axis = 0; axis < 3; ++axis) {
+        size_t parsed_length = 0;
+        parsed[axis] = std::stod(coordinates[axis], &parsed_length);
+        is_valid = is_valid && parsed_length == coordinates[axis].size() &&
+                   std::isfinite(parsed[axis]);
+      }
+      if (is_valid) {
+        return Point3(parsed[0], parsed[1], parsed[2]);
+      }
+    } catch (const std::logic_error &) {
+    }
+  }
+  throw std::invalid_argument("Invalid value for " + flag + ": " + value);
+}
+
+double parse_field_of_view(const std::string &flag, const std::string &value) {
+  try {
+    size_t parsed_length = 0;
+    const auto parsed = std::stod(value, &parsed_length);
+    if (parsed_length == value.size() && parsed > 0 && parsed < 180) {
+      return parsed;
+    }
+  } catch (const std::logic_error &) {
+  }
+  throw std::invalid_argument("Invalid value for " + flag + ": " + value);
+}
+
+Options parse_options(int argc, char **argv) {
+  Options options;
+  options.m_program_path = argv[0];
+
+  for (int index = 1; index < argc; ++index) {
+    const std::string flag = argv[index];
+
+    const auto next_value = [&]() -> std::string {
+      if (index + 1 >= argc) {
+        throw std::invalid_argument("Missing value for " + flag);
+      }
+      return argv[++index];
+    };
+
+    if (flag == "--scene") {
+      options.m_scene_name = next_value();
+    } else if (flag == "--width") {
+      options.m_image_width = parse_unsigned(flag, next_value());
+    } else if (flag == "--spp") {
+      options.m_samples_per_pixel = parse_unsigned(flag, next_value());
+    } else if (flag == "--heatmap") {
+      const auto metric = next_value();
+      if (metric == "nodes") {
+        options.m_render_mode = RenderMode::NodeHeatmap;
+      } else if (metric == "primitives") {
+        options.m_render_mode = RenderMode::PrimitiveHeatmap;
+      } else {
+        throw std::invalid_argument("Invalid value for --heatmap: " + metric);
+      }
+    } else if (flag == "--no-light-sampling") {
+      options.m_light_sampling = false;
+    } else if (flag == "--denoise") {
+      options.m_denoise = true;
+    } else if (flag == "--sort-rays") {
+      options.m_sort_rays = true;
+    } else if (flag == "--aov") {
+      options.m_auxiliary_prefix = next_value();
+    } else if (flag == "--primary-hits") {
+      options.m_primary_hits_path = next_value();
+    } else if (flag == "--threads") {
+      options.m_num_threads = parse_unsigned(flag, next_value());
+    } else if (flag == "--affinity") {
+      const auto placement = next_value();
+      if (placement == "none") {
+        options.m_thread_placement = ThreadPlacement::None;
+      } else if (placement == "compact") {
+        options.m_thread_placement = ThreadPlacement::Compact;
+      } else if (placement == "scatter") {
+        options.m_thread_placement = ThreadPlacement::Scatter;
+      } else {
+        throw std::invalid_argument("Invalid value for --affinity: " +
+                                    placement);
+      }
+    } else if (flag == "--replicate-scene") {
+      options.m_replicate_scene = true;
+    } else if (flag == "--time-budget") {
+      options.m_time_budget_seconds = parse_seconds(flag, next_value());
+    } else if (flag == "--pass-spp") {
+      options.m_samples_per_pass =
+          std::max(1u, parse_unsigned(flag, next_value()));
+    } else if (flag == "--snapshot-interval") {
+      options.m_snapshot_interval_seconds = parse_seconds(flag, next_value());
+    } else if (flag == "--snapshot") {
+      options.m_snapshot_path = next_value();
+    } else if (flag == "--checkpoint") {
+      options.m_checkpoint_path = next_value();
+    } else if (flag == "--checkpoint-interval") {
+      options.m_checkpoint_interval_seconds = parse_seconds(flag, next_value());
+    } else if (flag == "--resume") {
+      options.m_resume = true;
+    } else if (flag == "--frames") {
+      options.m_frames = parse_unsigned(flag, next_value());
+    } else if (flag == "--frame-rate") {
+      options.m_frame_rate = parse_seconds(flag, next_value());
+      if (options.m_frame_rate <= 0) {
+        throw std::invalid_argument("--frame-rate must be positive");
+      }
+    } else if (flag == "--shutter") {
+      options.m_shutter = std::min(1.0, parse_seconds(flag, next_value()));
+    } else if (flag == "--frame-pattern") {
+      options.m_frame_pattern = next_value();
+      if (!format_frame_path(options.m_frame_pattern, 0)) {
+        throw std::invalid_argument(
+            "--frame-pattern needs exactly one %d or %0Nd and no other %: " +
+            options.m_frame_pattern);
+      }
+    } else if (flag == "--rebuild-threshold") {
+      options.m_rebuild_threshold = parse_seconds(flag, next_value());
+    } else if (flag == "--coordinator") {
+      options.m_coordinator_address = next_value();
+    } else if (flag == "--worker") {
+      options.m_worker_address = next_value();
+    } else if (flag == "--spawn-workers") {
+      options.m_spawn_workers = parse_unsigned(flag, next_value());
+    } else if (flag == "--tile-rows") {
+      options.m_tile_rows = std::max(1u, parse_unsigned(flag, next_value()));
+    } else if (flag == "--tile-timeout") {
+      options.m_tile_timeout =
+          std::max(1u, parse_unsigned(flag, next_value()));
+    } else if (flag == "--convergence") {
+      options.m_convergence = true;
+    } else if (flag == "--reference-dir") {
+      options.m_reference_directory = next_value();
+    } else if (flag == "--reference-spp") {
+      options.m_reference_samples_per_pixel =
+          parse_unsigned(flag, next_value());
+    } else if (flag == "--max-spp") {
+      options.m_max_samples_per_pixel = parse_unsigned(flag, next_value());
+    } else if (flag == "--scaling") {
+      options.m_scaling = true;
+    } else if (flag == "--scene-scaling") {
+      options.m_scene_scaling = true;
+    } else if (flag == "--scene-sizes") {
+      options.m_scene_sizes.clear();
+      for (const auto &size : split_list(next_value())) {
+        options.m_scene_sizes.push_back(parse_count(flag, size));
+      }
+    } else if (flag == "--distributions") {
+      options.m_scene_distributions.clear();
+      for (const auto &name : split_list(next_value())) {
+        const auto distribution = parse_sphere_distribution(name);
+        if (!distribution) {
+          throw std::invalid_argument("Invalid value for --distributions: " +
+                                      name);
+        }
+        options.m_scene_distributions.push_back(*distribution);
+      }
+    } else if (flag == "--lazy-bvh") {
+      options.m_lazy_bvh = true;
+    } else if (flag == "--compressed-bvh") {
+      options.m_compressed_bvh = true;
+    } else if (flag == "--trace") {
+      options.m_trace_path = next_value();
+    } else if (flag == "--serve") {
+      options.m_serve_address = next_value();
+    } else if (flag == "--scene-cache") {
+      options.m_scene_cache_size = parse_unsigned(flag, next_value());
+    } else {
+      throw std::invalid_argument("Unknown option: " + flag);
+    }
+  }
+
+  // Unpinned threads have no node to pick a copy by
+  if (options.m_replicate_scene &&
+      options.m_thread_placement == ThreadPlacement::None) {
+    throw std::invalid_argument("--replicate-scene needs --affinity");
+  }
+
+  // Renders always build the whole, full precision tree up front
+  if (options.m_lazy_bvh && !options.m_scene_scaling) {
+    throw std::invalid_argument("--lazy-bvh only applies to --scene-scaling");
+  }
+  if (options.m_compressed_bvh && !options.m_scene_scaling) {
+    throw std::invalid_argument(
+        "--compressed-bvh only applies to --scene-scaling");
+  }
+
+  if (options.m_lazy_bvh && options.m_compressed_bvh) {
+    throw std::invalid_argument(
+        "--lazy-bvh and --compressed-bvh can't be combined");
+  }
+
+  return options;
+}
+
+std::string usage(const std::string &program) {
+  return "Usage: " + program +
+         " [options] > image.ppm\n"
+         "  --scene NAME          many_balls | checkered_spheres |\n"
+         "                        bouncing_balls | sphere_lights | quads\n"
+         "  --width PIXELS        override the scene's image width\n"
+         "  --spp SAMPLES         override the scene's samples per pixel\n"
+         "  --heatmap METRIC      nodes | primitives, write a false colour\n"
+         "                        image of the per ray traversal cost, needs\n"
+         "                        a build with -DRT_TRAVERSAL_STATS=ON\n"
+         "  --no-light-sampling   find lights by chance bounces only\n"
+         "  --denoise             filter the image guided by the albedo,\n"
+         "                        normal and depth of the first hits\n"
+         "  --aov PREFIX          also write those as PREFIX_albedo.pfm,\n"
+         "                        PREFIX_normal.pfm and PREFIX_depth.pfm\n"
+         "  --sort-rays           trace each row's secondary rays a bounce\n"
+         "                        at a time, sorted by origin and direction\n"
+         "  --primary-hits PATH   record where every sample's primary ray\n"
+         "                        hits to PATH, or if it holds those of the\n"
+         "                        same camera and geometry, shade them from\n"
+         "                        it instead of tracing, for quick re-renders\n"
+         "                        after material or sky changes\n"
+         "  --trace PATH          record what every thread does and write it\n"
+         "                        as a Chrome trace, for chrome://tracing or\n"
+         "                        ui.perfetto.dev\n"
+         "\n"
+         "Threads:\n"
+         "  --threads N           worker threads (all cores but one)\n"
+         "  --affinity PLACEMENT  none | compact | scatter, pin the threads\n"
+         "                        filling one NUMA node after the other or\n"
+         "                        spread over all of them (none)\n"
+         "  --replicate-scene     build a copy of the scene on every NUMA\n"
+         "                        node, needs --affinity\n"
+         "\n"
+         "Progressive rendering:\n"
+         "  --time-budget SECONDS render passes until the budget runs out,\n"
+         "                        --spp becomes the upper limit\n"
+         "  --pass-spp SAMPLES    samples per pixel in each pass (1)\n"
+         "  --snapshot-interval SECONDS\n"
+         "                        write the image so far this often\n"
+         "  --snapshot PATH       where snapshots go (snapshot.ppm)\n"
+         "  --checkpoint PATH     periodically save the accumulated samples,\n"
+         "                        also on its own enables progressive mode\n"
+         "  --checkpoint-interval SECONDS\n"
+         "                        time between checkpoints (60)\n"
+         "  --resume              continue from the checkpoint if it matches\n"
+         "                        the scene and camera\n"
+         "\n"
+         "Animation sequences, for animated scenes (bouncing_balls):\n"
+         "  --frames N            render N frames in one process\n"
+         "  --frame-rate FPS      frames per second of scene time (24)\n"
+         "  --shutter FRACTION    of each frame the shutter is open (0.5)\n"
+         "  --frame-pattern PATTERN\n"
+         "                        frame file names, with one %d or %0Nd\n"
+         "                        for the frame number (frame_%04d.ppm)\n"
+         "  --rebuild-threshold RATIO\n"
+         "                        rebuild the BVH rather than refit it once\n"
+         "                        its mean node area grows by this factor\n"
+         "                        (1.5)\n"
+         "\n"
+         "Distributed rendering, ADDRESS is unix:PATH or tcp:HOST:PORT:\n"
+         "  --coordinator ADDRESS listen for workers, hand out tiles and\n"
+         "                        write the merged image\n"
+         "  --worker ADDRESS      render tiles for the coordinator there\n"
+         "  --spawn-workers N     start N local workers for the coordinator,\n"
+         "                        each with --threads or a share of the cores\n"
+         "  --tile-rows ROWS      rows per tile (16)\n"
+         "  --tile-timeout SECONDS\n"
+         "                        hand a tile to another worker too when it\n"
+         "                        hasn't come back by then (300)\n"
+         "\n"
+         "Convergence benchmark:\n"
+         "  --convergence         render at 1, 2, 4, ... spp and report the\n"
+         "                        error against a high spp reference as CSV\n"
+         "  --reference-dir DIR   where references are stored (references)\n"
+         "  --reference-spp N     samples per pixel of the reference (4096)\n"
+         "  --max-spp N           largest sample budget to measure (256)\n"
+         "\n"
+         "Thread scaling benchmark:\n"
+         "  --scaling             render with 1, 2, 4, ... threads up to\n"
+         "                        every core and report the speedup as CSV\n"
+         "\n"
+         "Scene size scaling benchmark:\n"
+         "  --scene-scaling       generate sphere scenes of every size and\n"
+         "                        distribution, trace incoherent rays with\n"
+         "                        1, 2, 4, ... threads and report the BVH\n"
+         "                        build time, memory per sphere, Mrays/s and\n"
+         "                        parallel efficiency as CSV\n"
+         "  --scene-sizes LIST    comma separated sphere counts\n"
+         "                        (1000,10000,100000,1000000), also written\n"
+         "                        like 1e6. Each sphere and its share of the\n"
+         "                        tree take about 550 bytes, 300 with\n"
+         "                        --compressed-bvh, so 1e7 needs some 5 GB\n"
+         "  --distributions LIST  of uniform, clustered and overlapping\n"
+         "                        (all three)\n"
+         "  --lazy-bvh            build only the top of each tree up front\n"
+         "                        and the rest as rays reach it, renders\n"
+         "                        always build the whole tree\n"
+         "  --compressed-bvh      trace a tree with cache line nodes and\n"
+         "                        8 bit child bounds, renders always use\n"
+         "                        the full precision tree\n"
+         "\n"
+         "Render server:\n"
+         "  --serve ADDRESS       take jobs, one per line, from unix:PATH,\n"
+         "                        tcp:HOST:PORT or - for standard input:\n"
+         "                        scene=NAME width=N spp=N output=PATH\n"
+         "                        [denoise=1] [light_sampling=0]\n"
+         "  --scene-cache N       built scenes to keep in memory (4)\n";
+}
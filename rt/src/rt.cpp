@@ -1,13 +1,25 @@
 #include <bvh.hpp>
 #include <camera.hpp>
+#include <denoiser.hpp>
 #include <hittable.hpp>
 #include <hittable_list.hpp>
 #include <material.hpp>
+#include <plane.hpp>
+#include <primary_hits.hpp>
+#include <quad.hpp>
+#include <replicated_world.hpp>
 #include <rt.hpp>
 #include <sphere.hpp>
 #include <texture.hpp>
+#include <thread_placement.hpp>
+#include <tracer.hpp>
 
+#include <cmath>
+#include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 HittableList scene_rt_one_weekend() {
 
@@ -16,8 +28,8 @@ HittableList scene_rt_one_weekend() {
   auto ground_material = std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
   auto checker = std::make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1),
                                                   Color(0.9, 0.9, 0.9));
-  world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000,
-                                     std::make_shared<Lambertian>(checker)));
+  world.add(std::make_shared<Plane>(Point3(0, 0, 0), Vec3(0, 1, 0),
+                                    std::make_shared<Lambertian>(checker)));
 
   for (int a = -11; a < 11; ++a) {
     for (int b = -11; b < 11; ++b) {
@@ -58,7 +70,7 @@ HittableList scene_rt_one_weekend() {
   world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
   world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
 
-  world = HittableList(std::make_shared<BoundedVolumeHierarchyNode>(world));
+  world = HittableList(std::make_shared<BoundedVolumeHierarchy>(world));
 
   return world;
 }
@@ -78,12 +90,176 @@ HittableList scene_checkered_spheres() {
   return world;
 }
 
-Camera camera_rt_one_weekend() {
+AnimatedWorld animated_bouncing_balls() {
+
+  struct Ball {
+    std::shared_ptr<Sphere> m_sphere;
+    Point3 m_rest;
+    Vec3 m_drift;
+    double m_height;
+    double m_phase;
+  };
+
+  AnimatedWorld animated;
+  std::vector<Ball> balls;
+
+  auto checker = std::make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1),
+                                                  Color(0.9, 0.9, 0.9));
+  animated.m_objects.push_back(std::make_shared<Plane>(
+      Point3(0, 0, 0), Vec3(0, 1, 0), std::make_shared<Lambertian>(checker)));
+
+  for (int a = -11; a < 11; ++a) {
+    for (int b = -11; b < 11; ++b) {
+      const Point3 rest(a + 0.6 * random_double(), 0.2,
+                        b + 0.6 * random_double());
+      if ((rest - Point3(4, 0.2, 0)).length() <= 0.9) {
+        continue;
+      }
+
+      const auto albedo = Color::random() * Color::random();
+      const auto sphere = std::make_shared<Sphere>(
+          rest, 0.2, std::make_shared<Lambertian>(albedo));
+      animated.m_objects.push_back(sphere);
+
+      // Drifting slowly apart makes a refitted tree worse over time
+      balls.push_back(Ball{sphere, rest,
+                           Vec3(random_double(-0.3, 0.3), 0,
+                                random_double(-0.3, 0.3)),
+                           random_double(0.2, 1.0),
+                           random_double(0, 2 * pi)});
+    }
+  }
+
+  animated.m_objects.push_back(std::make_shared<Sphere>(
+      Point3(-4, 1, 0), 1.0,
+      std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1))));
+  animated.m_objects.push_back(std::make_shared<Sphere>(
+      Point3(4, 1, 0), 1.0,
+      std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0)));
+
+  animated.m_animate = [balls](const double time_begin,
+                               const double time_end) {
+    const auto position = [](const Ball &ball, const double time) {
+      const double bounce = std::fabs(std::sin(2 * pi * time + ball.m_phase));
+      return ball.m_rest + time * ball.m_drift +
+             Vec3(0, ball.m_height * bounce, 0);
+    };
+    for (const auto &ball : balls) {
+      ball.m_sphere->move_to(position(ball, time_begin),
+                             position(ball, time_end));
+    }
+  };
+
+  return animated;
+}
+
+HittableList scene_bouncing_balls() {
+
+  AnimatedWorld animated = animated_bouncing_balls();
+  animated.m_animate(0, 0);
+
+  HittableList world;
+  for (const auto &object : animated.m_objects) {
+    world.add(object);
+  }
+
+  return HittableList(std::make_shared<BoundedVolumeHierarchy>(world));
+}
+
+// Small bright spheres lighting a room, with no sky to fall back on
+LightList lights_sphere_lights() {
+
+  LightList lights;
+  lights.add(std::make_shared<Sphere>(
+      Point3(0, 3, 2), 0.25,
+      std::make_shared<DiffuseLight>(Color(40, 36, 30))));
+  lights.add(std::make_shared<Sphere>(
+      Point3(-3, 2, -2), 0.2,
+      std::make_shared<DiffuseLight>(Color(10, 20, 40))));
+  lights.add(std::make_shared<Sphere>(
+      Point3(3, 1.5, -2), 0.15,
+      std::make_shared<DiffuseLight>(Color(60, 30, 10))));
+  return lights;
+}
+
+HittableList scene_sphere_lights() {
+
+  HittableList world;
+
+  auto checker = std::make_shared<CheckerTexture>(0.32, Color(0.2, 0.3, 0.1),
+                                                  Color(0.9, 0.9, 0.9));
+  world.add(std::make_shared<Plane>(Point3(0, 0, 0), Vec3(0, 1, 0),
+                                    std::make_shared<Lambertian>(checker)));
+  // The walls and ceiling, seen from the inside
+  world.add(std::make_shared<Sphere>(
+      Point3(0, 0, 0), 40, std::make_shared<Lambertian>(Color(0.6, 0.6, 0.6))));
+
+  for (int a = -5; a < 5; ++a) {
+    for (int b = -5; b < 5; ++b) {
+      const auto choose_material = random_double();
+      const Point3 center(a + 0.6 * random_double(), 0.2,
+                          b + 0.6 * random_double());
+
+      std::shared_ptr<Material> sphere_material;
+      if (choose_material < 0.8) {
+        sphere_material =
+            std::make_shared<Lambertian>(Color::random() * Color::random());
+      } else if (choose_material < 0.95) {
+        sphere_material = std::make_shared<Metal>(Color::random(0.5, 1.0),
+                                                  random_double(0.0, 0.5));
+      } else {
+        sphere_material = std::make_shared<Dielectric>(1.50);
+      }
+      world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+    }
+  }
+
+  world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0,
+                                     std::make_shared<Dielectric>(1.5)));
+  world.add(std::make_shared<Sphere>(
+      Point3(-4, 1, 0), 1.0,
+      std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1))));
+  world.add(std::make_shared<Sphere>(
+      Point3(4, 1, 0), 1.0,
+      std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0)));
+
+  const LightList lights = lights_sphere_lights();
+  for (const auto &light : lights.lights()) {
+    world.add(light);
+  }
+
+  return HittableList(std::make_shared<BoundedVolumeHierarchy>(world));
+}
+
+HittableList scene_quads() {
+
+  HittableList world;
+
+  const auto left_red = std::make_shared<Lambertian>(Color(1.0, 0.2, 0.2));
+  const auto back_green = std::make_shared<Lambertian>(Color(0.2, 1.0, 0.2));
+  const auto right_blue = std::make_shared<Lambertian>(Color(0.2, 0.2, 1.0));
+  const auto upper_orange = std::make_shared<Lambertian>(Color(1.0, 0.5, 0.0));
+  const auto lower_teal = std::make_shared<Lambertian>(Color(0.2, 0.8, 0.8));
+
+  world.add(std::make_shared<Quad>(Point3(-3, -2, 5), Vec3(0, 0, -4),
+                                   Vec3(0, 4, 0), left_red));
+  world.add(std::make_shared<Quad>(Point3(-2, -2, 0), Vec3(4, 0, 0),
+                                   Vec3(0, 4, 0), back_green));
+  world.add(std::make_shared<Quad>(Point3(3, -2, 1), Vec3(0, 0, 4),
+                                   Vec3(0, 4, 0), right_blue));
+  world.add(std::make_shared<Quad>(Point3(-2, 3, 1), Vec3(4, 0, 0),
+                                   Vec3(0, 0, 4), upper_orange));
+  world.add(std::make_shared<Quad>(Point3(-2, -3, 5), Vec3(4, 0, 0),
+                                   Vec3(0, 0, -4), lower_teal));
+
+  return HittableList(std::make_shared<BoundedVolumeHierarchy>(world));
+}
+
+Camera camera_rt_one_weekend(const unsigned int image_width,
+                             const unsigned int samples_per_pixel) {
 
   // Image
   const double aspect_ratio = 16.0 / 9.0;
-  const unsigned int image_width = 2000;
-  const unsigned int samples_per_pixel = 500;
   const unsigned int max_depth = 50;
   const Point3 camera_position = Point3(13, 2, 3);
   const Point3 looking_at = Point3(0, 0, 0);
@@ -98,12 +274,11 @@ Camera camera_rt_one_weekend() {
   return camera;
 }
 
-Camera camera_checkered_spheres() {
+Camera camera_checkered_spheres(const unsigned int image_width,
+                                const unsigned int samples_per_pixel) {
 
   // Image
   const double aspect_ratio = 16.0 / 9.0;
-  const unsigned int image_width = 400;
-  const unsigned int samples_per_pixel = 100;
   const unsigned int max_depth = 50;
   const Point3 camera_position = Point3(13, 2, 3);
   const Point3 looking_at = Point3(0, 0, 0);
@@ -118,22 +293,219 @@ Camera camera_checkered_spheres() {
   return camera;
 }
 
-void many_balls_scene() {
+Camera camera_sphere_lights(const unsigned int image_width,
+                            const unsigned int samples_per_pixel) {
 
-  Camera camera = camera_rt_one_weekend();
+  // Image
+  const double aspect_ratio = 16.0 / 9.0;
+  // Paths never escape the room, so cap them well below the outdoor scenes
+  const unsigned int max_depth = 10;
+  const Point3 camera_position = Point3(13, 2, 3);
+  const Point3 looking_at = Point3(0, 0, 0);
+  const Vec3 up_direction = Point3(0, 1, 0);
+  const double vertical_field_of_view = 25;
+  const double defocus_angle = 0.0;
+  const double focus_dist = 10.0;
+  Camera camera(aspect_ratio, image_width, samples_per_pixel, max_depth,
+                camera_position, looking_at, up_direction,
+                vertical_field_of_view, defocus_angle, focus_dist);
 
-  HittableList world = scene_rt_one_weekend();
+  return camera;
+}
 
-  // Render
-  camera.render(world);
+Camera camera_quads(const unsigned int image_width,
+                    const unsigned int samples_per_pixel) {
+
+  // Image
+  const double aspect_ratio = 1.0;
+  const unsigned int max_depth = 50;
+  const Point3 camera_position = Point3(0, 0, 9);
+  const Point3 looking_at = Point3(0, 0, 0);
+  const Vec3 up_direction = Point3(0, 1, 0);
+  const double vertical_field_of_view = 80;
+  const double defocus_angle = 0.0;
+  const double focus_dist = 10.0;
+  Camera camera(aspect_ratio, image_width, samples_per_pixel, max_depth,
+                camera_position, looking_at, up_direction,
+                vertical_field_of_view, defocus_angle, focus_dist);
+
+  return camera;
 }
 
-void checkered_spheres() {
+const std::vector<SceneDescription> &built_in_scenes() {
+  static const std::vector<SceneDescription> scenes{
+      {"many_balls", 2000, 500, scene_rt_one_weekend, camera_rt_one_weekend},
+      {"checkered_spheres", 400, 100, scene_checkered_spheres,
+       camera_checkered_spheres},
+      {"bouncing_balls", 400, 50, scene_bouncing_balls,
+       camera_rt_one_weekend, animated_bouncing_balls},
+      {"sphere_lights", 400, 64, scene_sphere_lights, camera_sphere_lights,
+       {}, lights_sphere_lights},
+      {"quads", 400, 100, scene_quads, camera_quads},
+  };
+  return scenes;
+}
 
-  Camera camera = camera_checkered_spheres();
+const SceneDescription *find_scene(const std::string &name) {
+  for (const auto &scene : built_in_scenes()) {
+    if (scene.m_name == name) {
+      return &scene;
+    }
+  }
+  return nullptr;
+}
 
-  HittableList world = scene_checkered_spheres();
+std::uint64_t scene_hash(const SceneDescription &scene,
+                         const Hittable &world) {
+  std::uint64_t hash = 0xcbf29ce484222325ull;
+  for (const char character : scene.m_name) {
+    hash = RandomGenerator::mix_bits(hash ^ std::uint64_t(character));
+  }
+  // Catches changes to the scene's code that the name doesn't
+  return RandomGenerator::mix_bits(hash ^
+                                   PrimitiveTable(world).geometry_hash());
+}
+
+namespace {
+
+// Scenes are laid out with random_double, fix the seed so that every process
+// builds exactly the same world
+template <typename t_Builder> auto build_with_scene_seed(t_Builder builder) {
+  constexpr unsigned int scene_seed = 0x5eed;
+  seed_random_generator(scene_seed);
+  auto world = builder();
+  seed_random_generator(std::random_device{}());
+  return world;
+}
+
+// The scene's camera, moved when the options give a view of their own
+Camera scene_camera(const SceneDescription &scene, const Options &options) {
+  Camera camera = scene.m_make_camera(
+      options.m_image_width ? options.m_image_width : scene.m_image_width,
+      options.m_samples_per_pixel ? options.m_samples_per_pixel
+                                  : scene.m_samples_per_pixel);
+  if (!options.m_look_from && !options.m_look_at &&
+      options.m_vertical_field_of_view <= 0) {
+    return camera;
+  }
+  const auto look_from = options.m_look_from.value_or(camera.camera_position());
+  const auto look_at = options.m_look_at.value_or(camera.looking_at());
+  if ((look_at - look_from).near_zero()) {
+    throw std::invalid_argument("The camera looks at its own position");
+  }
+  return camera.with_view(
+      look_from, look_at,
+      options.m_vertical_field_of_view > 0
+          ? options.m_vertical_field_of_view
+          : camera.vertical_field_of_view());
+}
+
+} // namespace
+
+HittableList make_world(const SceneDescription &scene) {
+  const TraceScope trace("make_world", "scene");
+  return build_with_scene_seed(scene.m_make_world);
+}
+
+HittableList make_world(const SceneDescription &scene,
+                        const Options &options) {
+  const auto topology = detect_cpu_topology();
+  if (!options.m_replicate_scene || topology.num_nodes() == 1) {
+    return make_world(scene);
+  }
+
+  // Each copy is built by a thread pinned to its node, so the first touch
+  // puts the copy's memory there too
+  std::vector<std::shared_ptr<Hittable>> replicas(topology.num_nodes());
+  std::vector<std::thread> builders;
+  for (unsigned int node = 0; node < topology.num_nodes(); ++node) {
+    builders.emplace_back([&, node] {
+      pin_current_thread(topology.m_node_cpus[node].front());
+      replicas[node] = std::make_shared<HittableList>(make_world(scene));
+    });
+  }
+  for (auto &builder : builders) {
+    builder.join();
+  }
+  std::clog << "Replicated the scene on " << topology.num_nodes()
+            << " NUMA nodes" << std::endl;
+
+  return HittableList(std::make_shared<ReplicatedWorld>(std::move(replicas)));
+}
+
+AnimatedWorld make_animated_world(const SceneDescription &scene) {
+  return build_with_scene_seed(scene.m_make_animated_world);
+}
+
+LightList make_lights(const SceneDescription &scene) {
+  if (!scene.m_make_lights) {
+    return LightList();
+  }
+  return build_with_scene_seed(scene.m_make_lights);
+}
+
+Camera make_camera(const SceneDescription &scene, const Options &options) {
+  Camera camera = scene_camera(scene, options);
+  if (options.m_light_sampling) {
+    camera.set_lights(make_lights(scene));
+  }
+  if (options.m_num_threads > 0 ||
+      options.m_thread_placement != ThreadPlacement::None) {
+    camera.set_threads(options.m_num_threads, options.m_thread_placement);
+  }
+  camera.set_denoise(options.m_denoise);
+  camera.set_sort_rays(options.m_sort_rays);
+  camera.set_auxiliary_buffers(!options.m_auxiliary_prefix.empty());
+  return camera;
+}
+
+void render_scene(const SceneDescription &scene, const Options &options) {
+
+  Camera camera = make_camera(scene, options);
+  camera.set_render_mode(options.m_render_mode);
+
+  HittableList world = make_world(scene, options);
 
   // Render
-  camera.render(world);
+  if (options.m_time_budget_seconds > 0 || !options.m_checkpoint_path.empty()) {
+    ProgressiveSettings settings;
+    settings.m_samples_per_pass = options.m_samples_per_pass;
+    settings.m_time_budget =
+        std::chrono::duration<double>(options.m_time_budget_seconds);
+    settings.m_snapshot_interval =
+        std::chrono::duration<double>(options.m_snapshot_interval_seconds);
+    settings.m_snapshot_path = options.m_snapshot_path;
+    settings.m_checkpoint_path = options.m_checkpoint_path;
+    settings.m_checkpoint_interval =
+        std::chrono::duration<double>(options.m_checkpoint_interval_seconds);
+    settings.m_resume = options.m_resume;
+    settings.m_scene_hash = scene_hash(scene, world);
+    camera.render_progressive(world, settings);
+  } else if (!options.m_primary_hits_path.empty()) {
+    // A missing, stale or corrupt file leaves the buffer empty, to be
+    // recorded
+    const auto primary_hits = std::make_shared<PrimaryHitBuffer>();
+    read_primary_hits(options.m_primary_hits_path,
+                      camera.primary_hits_header(world), *primary_hits);
+    camera.set_primary_hits(primary_hits);
+    camera.render_image(world);
+    if (!camera.replayed_primary_hits() &&
+        !write_primary_hits(options.m_primary_hits_path, *primary_hits)) {
+      std::cerr << "Could not write primary hits to "
+                << options.m_primary_hits_path << std::endl;
+    }
+  } else {
+    camera.render_image(world);
+  }
+  camera.write_image(std::cout);
+
+  if (options.m_auxiliary_prefix.empty()) {
+    return;
+  }
+  const TraceScope trace("write_auxiliary_buffers", "output");
+  if (!write_auxiliary_buffers(options.m_auxiliary_prefix,
+                               camera.auxiliary_buffers())) {
+    std::cerr << "Could not write auxiliary buffers to "
+              << options.m_auxiliary_prefix << "_*.pfm" << std::endl;
+  }
 }
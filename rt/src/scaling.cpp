@@ -0,0 +1,261 @@
+#include <scaling.hpp>
+
+#include <bvh.hpp>
+#include <camera.hpp>
+#include <compressed_bvh.hpp>
+#include <hittable_list.hpp>
+#include <lazy_bvh.hpp>
+#include <scene_generator.hpp>
+#include <sphere.hpp>
+#include <thread_placement.hpp>
+#include <thread_pool.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace {
+
+using t_Clock = std::chrono::steady_clock;
+
+constexpr unsigned int default_scaling_width = 320;
+constexpr unsigned int default_scaling_samples_per_pixel = 16;
+
+// Enough rays that every thread count runs for a while, few enough to keep
+// them in memory next to the largest scenes
+constexpr size_t scene_scaling_rays = size_t(1) << 20;
+
+// The corner view is square, and narrow enough to see a small part of the
+// largest scenes
+constexpr unsigned int corner_view_width = 128;
+constexpr double corner_view_field_of_view = 30;
+
+// 1, 2, 4, ... and finally every CPU the process may run on
+std::vector<unsigned int> scaling_thread_counts() {
+  const unsigned int num_cpus = detect_cpu_topology().num_cpus();
+  std::vector<unsigned int> thread_counts;
+  for (unsigned int num_threads = 1; num_threads < num_cpus;
+       num_threads *= 2) {
+    thread_counts.push_back(num_threads);
+  }
+  thread_counts.push_back(num_cpus);
+  return thread_counts;
+}
+
+// Rays from anywhere inside the box in every direction, like the bounces of
+// diffuse paths, so that they touch the whole tree
+std::vector<Ray> incoherent_rays(const AxisAlignedBoundingBox &box,
+                                 const size_t num_rays) {
+  seed_random_generator(0x7a75);
+  std::vector<Ray> rays;
+  rays.reserve(num_rays);
+  for (size_t index = 0; index < num_rays; ++index) {
+    const Point3 origin(
+        random_double(box.axis_interval(0).m_min, box.axis_interval(0).m_max),
+        random_double(box.axis_interval(1).m_min, box.axis_interval(1).m_max),
+        random_double(box.axis_interval(2).m_min, box.axis_interval(2).m_max));
+    rays.emplace_back(origin, random_unit_vector());
+  }
+  seed_random_generator(std::random_device{}());
+  return rays;
+}
+
+// Primary rays of a camera at the box's lowest corner looking at its centre,
+// row by row from the top left
+std::vector<Ray> corner_view_rays(const AxisAlignedBoundingBox &box) {
+  const Point3 origin(box.axis_interval(0).m_min, box.axis_interval(1).m_min,
+                      box.axis_interval(2).m_min);
+  const Point3 centre(
+      0.5 * (box.axis_interval(0).m_min + box.axis_interval(0).m_max),
+      0.5 * (box.axis_interval(1).m_min + box.axis_interval(1).m_max),
+      0.5 * (box.axis_interval(2).m_min + box.axis_interval(2).m_max));
+  const Vec3 w = unit_vector(origin - centre);
+  const Vec3 u = unit_vector(cross(Vec3(0, 1, 0), w));
+  const Vec3 v = cross(w, u);
+  const double half_size =
+      std::tan(degrees_to_radians(corner_view_field_of_view) / 2);
+
+  std::vector<Ray> rays;
+  rays.reserve(size_t(corner_view_width) * corner_view_width);
+  for (unsigned int row = 0; row < corner_view_width; ++row) {
+    for (unsigned int column = 0; column < corner_view_width; ++column) {
+      const double x = (column + 0.5) / corner_view_width * 2 - 1;
+      const double y = 1 - (row + 0.5) / corner_view_width * 2;
+      rays.emplace_back(origin, half_size * (x * u + y * v) - w);
+    }
+  }
+  return rays;
+}
+
+double built_fraction(const BoundedVolumeHierarchy &) { return 1.0; }
+
+double built_fraction(const LazyBoundedVolumeHierarchy &bvh) {
+  return bvh.built_fraction();
+}
+
+double built_fraction(const CompressedBoundedVolumeHierarchy &) { return 1.0; }
+
+const char *bvh_name(const Options &options) {
+  if (options.m_lazy_bvh) {
+    return "lazy";
+  }
+  return options.m_compressed_bvh ? "compressed" : "eager";
+}
+
+struct TraceResult {
+  double m_seconds;
+  size_t m_hits;
+};
+
+// Traces every ray once, spread over the pool's threads
+TraceResult trace_rays(ThreadPool &thread_pool, const Hittable &world,
+                       const std::vector<Ray> &rays) {
+  const unsigned int num_threads = thread_pool.num_threads();
+  std::vector<size_t> hits(num_threads);
+  const auto start = t_Clock::now();
+  thread_pool.run_on_each_thread([&](const unsigned int thread_index) {
+    HitRecord hit_record;
+    size_t thread_hits = 0;
+    for (size_t index = thread_index; index < rays.size();
+         index += num_threads) {
+      thread_hits +=
+          world.hit(rays[index], Interval(0.001, infinity), hit_record);
+    }
+    hits[thread_index] = thread_hits;
+  });
+  const std::chrono::duration<double> elapsed = t_Clock::now() - start;
+  return TraceResult{elapsed.count(),
+                     std::accumulate(std::begin(hits), std::end(hits),
+                                     size_t(0))};
+}
+
+// One scene of the scene scaling benchmark, t_Hierarchy is the eager, the
+// lazy or the compressed tree
+template <typename t_Hierarchy>
+void run_scene_scaling(const Options &options,
+                       const SphereDistribution distribution,
+                       const size_t num_spheres, std::ostream &out) {
+  auto spheres = generate_spheres(num_spheres, distribution);
+
+  const auto build_start = t_Clock::now();
+  const t_Hierarchy bvh(spheres, 0, spheres.size());
+  const std::chrono::duration<double> build_seconds =
+      t_Clock::now() - build_start;
+
+  // The tree holds on to the spheres, the list is only needed to build
+  spheres = {};
+
+  // Traced on this thread. The first ray stands in for the first pixel of
+  // a progressive display: it is the tree building such a pixel waits for,
+  // without the shading and bounces after it.
+  const auto view_rays = corner_view_rays(bvh.bounding_box());
+  HitRecord hit_record;
+  bvh.hit(view_rays.front(), Interval(0.001, infinity), hit_record);
+  const std::chrono::duration<double> first_ray_seconds =
+      t_Clock::now() - build_start;
+  for (const auto &ray : view_rays) {
+    bvh.hit(ray, Interval(0.001, infinity), hit_record);
+  }
+  const double view_built_fraction = built_fraction(bvh);
+  // Each sphere shares its allocation with a control block of two counts
+  const double bytes_per_sphere =
+      double(sizeof(Sphere) + 2 * sizeof(int)) +
+      double(bvh.memory_bytes()) / num_spheres;
+
+  const auto rays = incoherent_rays(bvh.bounding_box(), scene_scaling_rays);
+
+  double single_thread_seconds = 0;
+  for (const auto num_threads : scaling_thread_counts()) {
+    ThreadPool thread_pool(num_threads, options.m_thread_placement);
+    thread_pool.start();
+    // The first pass warms the caches and faults the pages in, and builds
+    // whatever the lazy tree is still missing
+    trace_rays(thread_pool, bvh, rays);
+    const auto result = trace_rays(thread_pool, bvh, rays);
+    thread_pool.stop();
+
+    if (num_threads == 1) {
+      single_thread_seconds = result.m_seconds;
+    }
+    const double speedup = single_thread_seconds / result.m_seconds;
+
+    out << to_string(distribution) << "," << num_spheres << ","
+        << bvh_name(options) << "," << build_seconds.count() << ","
+        << first_ray_seconds.count() << "," << view_built_fraction << ","
+        << bytes_per_sphere << "," << num_threads << "," << rays.size() << ","
+        << double(result.m_hits) / rays.size() << "," << result.m_seconds
+        << "," << rays.size() / result.m_seconds / 1e6 << "," << speedup
+        << "," << speedup / num_threads << std::endl;
+  }
+}
+
+} // namespace
+
+bool run_scaling_benchmark(const SceneDescription &scene,
+                           const Options &options, std::ostream &out) {
+  const auto thread_counts = scaling_thread_counts();
+
+  const HittableList world = make_world(scene, options);
+
+  out << "scene,width,height,spp,threads,seconds,samples_per_second,speedup,"
+         "efficiency\n";
+
+  double single_thread_seconds = 0;
+  for (const auto num_threads : thread_counts) {
+    Options thread_options = options;
+    thread_options.m_image_width = options.m_image_width
+                                       ? options.m_image_width
+                                       : default_scaling_width;
+    thread_options.m_samples_per_pixel =
+        options.m_samples_per_pixel ? options.m_samples_per_pixel
+                                    : default_scaling_samples_per_pixel;
+    thread_options.m_num_threads = num_threads;
+    Camera camera = make_camera(scene, thread_options);
+
+    const auto start = std::chrono::steady_clock::now();
+    camera.render_image(world);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    if (num_threads == 1) {
+      single_thread_seconds = elapsed.count();
+    }
+    const double samples = double(camera.image_width()) *
+                           camera.image_height() * camera.samples_per_pixel();
+    const double speedup = single_thread_seconds / elapsed.count();
+
+    out << scene.m_name << "," << camera.image_width() << ","
+        << camera.image_height() << "," << camera.samples_per_pixel() << ","
+        << num_threads << "," << elapsed.count() << ","
+        << samples / elapsed.count() << "," << speedup << ","
+        << speedup / num_threads << std::endl;
+  }
+
+  return true;
+}
+
+bool run_scene_scaling_benchmark(const Options &options, std::ostream &out) {
+  out << "distribution,spheres,bvh,build_seconds,first_ray_seconds,"
+         "view_built_fraction,bytes_per_sphere,threads,rays,hit_fraction,"
+         "seconds,mrays_per_second,speedup,efficiency\n";
+
+  for (const auto distribution : options.m_scene_distributions) {
+    for (const auto num_spheres : options.m_scene_sizes) {
+      if (options.m_lazy_bvh) {
+        run_scene_scaling<LazyBoundedVolumeHierarchy>(options, distribution,
+                                                      num_spheres, out);
+      } else if (options.m_compressed_bvh) {
+        run_scene_scaling<CompressedBoundedVolumeHierarchy>(
+            options, distribution, num_spheres, out);
+      } else {
+        run_scene_scaling<BoundedVolumeHierarchy>(options, distribution,
+                                                  num_spheres, out);
+      }
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,103 @@
+#include <scene_generator.hpp>
+
+#include <constants.hpp>
+#include <material.hpp>
+#include <sphere.hpp>
+#include <vec3.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace {
+
+constexpr std::uint64_t generator_seed = 0x6e7e;
+
+// Spheres per cluster in the clustered distribution
+constexpr size_t cluster_size = 1000;
+
+} // namespace
+
+std::string to_string(const SphereDistribution distribution) {
+  switch (distribution) {
+  case SphereDistribution::Uniform:
+    return "uniform";
+  case SphereDistribution::Clustered:
+    return "clustered";
+  case SphereDistribution::Overlapping:
+    return "overlapping";
+  }
+  return "unknown";
+}
+
+std::optional<SphereDistribution>
+parse_sphere_distribution(const std::string &name) {
+  for (const auto distribution :
+       {SphereDistribution::Uniform, SphereDistribution::Clustered,
+        SphereDistribution::Overlapping}) {
+    if (to_string(distribution) == name) {
+      return distribution;
+    }
+  }
+  return std::nullopt;
+}
+
+std::vector<std::shared_ptr<Hittable>>
+generate_spheres(const size_t num_spheres,
+                 const SphereDistribution distribution) {
+  seed_random_generator(generator_seed);
+
+  const std::vector<std::shared_ptr<Material>> materials{
+      std::make_shared<Lambertian>(Color(0.7, 0.3, 0.3)),
+      std::make_shared<Lambertian>(Color(0.3, 0.7, 0.3)),
+      std::make_shared<Lambertian>(Color(0.3, 0.3, 0.7)),
+      std::make_shared<Metal>(Color(0.8, 0.8, 0.8), 0.2),
+  };
+  const auto random_material = [&] {
+    return materials[std::min(size_t(random_double() * materials.size()),
+                              materials.size() - 1)];
+  };
+
+  // One unit of space per sphere
+  const double half_size = 0.5 * std::cbrt(double(num_spheres));
+  const auto random_point = [half_size] {
+    return Point3::random(-half_size, half_size);
+  };
+
+  std::vector<std::shared_ptr<Hittable>> spheres;
+  spheres.reserve(num_spheres);
+
+  switch (distribution) {
+  case SphereDistribution::Uniform:
+    for (size_t index = 0; index < num_spheres; ++index) {
+      spheres.push_back(
+          std::make_shared<Sphere>(random_point(), 0.2, random_material()));
+    }
+    break;
+
+  case SphereDistribution::Clustered: {
+    const size_t num_clusters =
+        std::max<size_t>(1, num_spheres / cluster_size);
+    std::vector<Point3> cluster_centers(num_clusters);
+    for (auto &center : cluster_centers) {
+      center = random_point();
+    }
+    for (size_t index = 0; index < num_spheres; ++index) {
+      const Point3 &center = cluster_centers[index % num_clusters];
+      spheres.push_back(std::make_shared<Sphere>(
+          center + Vec3::random_gaussian(), 0.05, random_material()));
+    }
+    break;
+  }
+
+  case SphereDistribution::Overlapping:
+    for (size_t index = 0; index < num_spheres; ++index) {
+      spheres.push_back(
+          std::make_shared<Sphere>(random_point(), 1.5, random_material()));
+    }
+    break;
+  }
+
+  seed_random_generator(std::random_device{}());
+  return spheres;
+}
@@ -0,0 +1,120 @@
+#include <sequence.hpp>
+
+#include <bvh.hpp>
+#include <camera.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+using t_Clock = std::chrono::steady_clock;
+
+double seconds_since(const t_Clock::time_point start) {
+  return std::chrono::duration<double>(t_Clock::now() - start).count();
+}
+
+} // namespace
+
+std::optional<std::string> format_frame_path(const std::string &pattern,
+                                             const unsigned int frame) {
+  const size_t percent = pattern.find('%');
+  if (percent == std::string::npos) {
+    return std::nullopt;
+  }
+
+  // An optional zero padded width, then the d
+  size_t position = percent + 1;
+  size_t width = 0;
+  if (position < pattern.size() && pattern[position] == '0') {
+    ++position;
+    while (position < pattern.size() && pattern[position] >= '0' &&
+           pattern[position] <= '9' && width < 100) {
+      width = width * 10 + size_t(pattern[position] - '0');
+      ++position;
+    }
+    if (width == 0 || width >= 100) {
+      return std::nullopt;
+    }
+  }
+  if (position == pattern.size() || pattern[position] != 'd' ||
+      pattern.find('%', position) != std::string::npos) {
+    return std::nullopt;
+  }
+
+  std::string number = std::to_string(frame);
+  if (number.size() < width) {
+    number.insert(0, width - number.size(), '0');
+  }
+  return pattern.substr(0, percent) + number + pattern.substr(position + 1);
+}
+
+bool render_sequence(const SceneDescription &scene, const Options &options) {
+  if (!scene.m_make_animated_world) {
+    std::cerr << "Scene " << scene.m_name << " has no animation" << std::endl;
+    return false;
+  }
+
+  const AnimatedWorld animated = make_animated_world(scene);
+
+  Camera camera = make_camera(scene, options);
+  camera.set_keep_threads_alive(true);
+
+  const double frame_duration = 1.0 / options.m_frame_rate;
+  const auto animate = [&](const unsigned int frame) {
+    const double time_begin = frame * frame_duration;
+    animated.m_animate(time_begin,
+                       time_begin + options.m_shutter * frame_duration);
+  };
+
+  // The tree sorts the object list it is built from, so it gets a copy
+  const auto build = [&animated] {
+    std::vector<std::shared_ptr<Hittable>> objects(animated.m_objects);
+    return std::make_unique<BoundedVolumeHierarchy>(objects, 0,
+                                                    objects.size());
+  };
+
+  animate(0);
+  auto bvh = build();
+
+  for (unsigned int frame = 0; frame < options.m_frames; ++frame) {
+    const auto update_start = t_Clock::now();
+    const char *update = "build";
+    if (frame > 0) {
+      animate(frame);
+      bvh->refit();
+      update = "refit";
+      if (bvh->refit_growth() > options.m_rebuild_threshold) {
+        bvh = build();
+        update = "rebuild";
+      }
+    }
+    const double update_seconds = seconds_since(update_start);
+    const double growth = bvh->refit_growth();
+
+    const auto render_start = t_Clock::now();
+    camera.render_image(*bvh);
+    const double render_seconds = seconds_since(render_start);
+
+    // Checked when the options were parsed
+    const auto path = *format_frame_path(options.m_frame_pattern, frame);
+    std::ofstream out(path);
+    camera.write_image(out);
+    if (!out) {
+      std::cerr << "Could not write " << path << std::endl;
+      return false;
+    }
+
+    std::clog << "\rFrame " << frame << ": " << update << " "
+              << update_seconds * 1e3 << " ms (node area x" << growth
+              << "), render " << render_seconds << " s -> " << path
+              << std::endl;
+  }
+
+  camera.set_keep_threads_alive(false);
+  return true;
+}
@@ -0,0 +1,318 @@
+#include <server.hpp>
+
+#include <camera.hpp>
+#include <hittable_list.hpp>
+#include <image.hpp>
+#include <rt.hpp>
+#include <socket.hpp>
+#include <thread_pool.hpp>
+
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <poll.h>
+#include <unistd.h>
+
+namespace {
+
+// The most recently used worlds, by scene name
+class SceneCache {
+public:
+  SceneCache(const size_t capacity, const Options &options)
+      : m_capacity(std::max<size_t>(capacity, 1))
+      , m_options(options) {}
+
+  std::shared_ptr<const HittableList> world(const SceneDescription &scene) {
+    const auto cached = m_index.find(scene.m_name);
+    if (cached != std::end(m_index)) {
+      m_entries.splice(std::begin(m_entries), m_entries, cached->second);
+      return cached->second->second;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto world =
+        std::make_shared<const HittableList>(make_world(scene, m_options));
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::clog << "Built " << scene.m_name << " in " << elapsed.count() << " s"
+              << std::endl;
+
+    m_entries.emplace_front(scene.m_name, world);
+    m_index[scene.m_name] = std::begin(m_entries);
+    if (m_entries.size() > m_capacity) {
+      std::clog << "Evicted " << m_entries.back().first << std::endl;
+      m_index.erase(m_entries.back().first);
+      m_entries.pop_back();
+    }
+    return world;
+  }
+
+private:
+  using t_Entry = std::pair<std::string, std::shared_ptr<const HittableList>>;
+
+  const size_t m_capacity;
+  const Options &m_options;
+  std::list<t_Entry> m_entries;
+  std::unordered_map<std::string, std::list<t_Entry>::iterator> m_index;
+};
+
+class RenderServer {
+public:
+  explicit RenderServer(const Options &options)
+      : m_options(options)
+      , m_scenes(options.m_scene_cache_size, options)
+      , m_thread_pool(std::make_shared<ThreadPool>(
+            options.m_num_threads ? options.m_num_threads
+                                  : ThreadPool::default_num_threads(),
+            options.m_thread_placement)) {
+    m_thread_pool->start();
+  }
+
+  ~RenderServer() { m_thread_pool->stop(); }
+
+  // Renders the job on the line and returns the reply
+  std::string handle(const std::string &line) {
+    try {
+      return render(line);
+    } catch (const std::exception &error) {
+      return std::string("error ") + error.what();
+    }
+  }
+
+private:
+  std::string render(const std::string &line) {
+    Options job_options = m_options;
+    std::string output;
+
+    std::stringstream fields(line);
+    std::string field;
+    while (fields >> field) {
+      const auto equals = field.find('=');
+      if (equals == std::string::npos) {
+        throw std::invalid_argument("expected key=value, got " + field);
+      }
+      const auto key = field.substr(0, equals);
+      const auto value = field.substr(equals + 1);
+      if (key == "scene") {
+        job_options.m_scene_name = value;
+      } else if (key == "width") {
+        job_options.m_image_width =
+            parse_bounded(key, value, max_image_width);
+      } else if (key == "spp") {
+        job_options.m_samples_per_pixel =
+            parse_bounded(key, value, max_samples_per_pixel);
+      } else if (key == "look_from") {
+        job_options.m_look_from = parse_point(key, value);
+      } else if (key == "look_at") {
+        job_options.m_look_at = parse_point(key, value);
+      } else if (key == "vfov") {
+        job_options.m_vertical_field_of_view =
+            parse_field_of_view(key, value);
+      } else if (key == "output") {
+        output = value;
+      } else if (key == "denoise") {
+        job_options.m_denoise = value != "0";
+      } else if (key == "light_sampling") {
+        job_options.m_light_sampling = value != "0";
+      } else {
+        throw std::invalid_argument("unknown key " + key);
+      }
+    }
+    if (output.empty()) {
+      throw std::invalid_argument("missing output");
+    }
+
+    const SceneDescription *scene = find_scene(job_options.m_scene_name);
+    if (scene == nullptr) {
+      throw std::invalid_argument("unknown scene " + job_options.m_scene_name);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto world = m_scenes.world(*scene);
+
+    // The pool is the server's, the camera must not make its own
+    job_options.m_num_threads = 0;
+    job_options.m_thread_placement = ThreadPlacement::None;
+    Camera camera = make_camera(*scene, job_options);
+    camera.set_thread_pool(m_thread_pool);
+    camera.set_keep_threads_alive(true);
+    camera.render_image(*world);
+
+    const bool written = write_output(output, camera);
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (!written) {
+      throw std::runtime_error("could not write " + output);
+    }
+    return "ok " + output + " " + std::to_string(elapsed.count());
+  }
+
+  // Bounds on one job, checked before anything is allocated for it
+  static constexpr unsigned int max_image_width = 16384;
+  static constexpr unsigned int max_samples_per_pixel = 1 << 16;
+
+  static unsigned int parse_bounded(const std::string &key,
+                                    const std::string &value,
+                                    const unsigned int max_value) {
+    const auto parsed = parse_unsigned(key, value);
+    if (parsed == 0 || parsed > max_value) {
+      throw std::invalid_argument("Invalid value for " + key + ": " + value);
+    }
+    return parsed;
+  }
+
+  static bool write_output(const std::string &path, const Camera &camera) {
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".pfm") == 0) {
+      return write_pfm(path, camera.float_image());
+    }
+    std::ofstream out(path);
+    camera.write_image(out);
+    return bool(out);
+  }
+
+  const Options &m_options;
+  SceneCache m_scenes;
+  std::shared_ptr<ThreadPool> m_thread_pool;
+};
+
+// Longer job lines than any real job, a client that sends one is dropped
+constexpr size_t max_line_length = 64 * 1024;
+
+struct Client {
+  Socket m_socket;
+  std::string m_buffer;
+  bool m_is_open = true;
+};
+
+bool serve_standard_input(RenderServer &server) {
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (line == "quit") {
+      break;
+    }
+    if (line.find_first_not_of(" \t") == std::string::npos) {
+      continue;
+    }
+    std::cout << server.handle(line) << std::endl;
+  }
+  return true;
+}
+
+bool serve_socket(RenderServer &server, const std::string &address) {
+  const Socket listener = Socket::listen(address);
+  std::clog << "Serving on " << address << std::endl;
+
+  std::list<std::shared_ptr<Client>> clients;
+  // Jobs are taken in arrival order across all clients
+  std::deque<std::pair<std::shared_ptr<Client>, std::string>> pending;
+  bool should_quit = false;
+
+  while (!should_quit) {
+    std::vector<pollfd> descriptors{{listener.file_descriptor(), POLLIN, 0}};
+    for (const auto &client : clients) {
+      descriptors.push_back({client->m_socket.file_descriptor(), POLLIN, 0});
+    }
+
+    // Only block when there is nothing left to render
+    if (::poll(descriptors.data(), descriptors.size(),
+               pending.empty() ? -1 : 0) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("poll failed");
+    }
+
+    size_t descriptor_index = 1;
+    for (auto client = std::begin(clients); client != std::end(clients);
+         ++descriptor_index) {
+      if (!(descriptors[descriptor_index].revents &
+            (POLLIN | POLLHUP | POLLERR))) {
+        ++client;
+        continue;
+      }
+
+      // A client that fails to read is dropped, not the server
+      char chunk[4096];
+      size_t received = 0;
+      try {
+        received = (*client)->m_socket.receive_some(chunk, sizeof(chunk));
+      } catch (const std::runtime_error &) {
+      }
+      if (received == 0) {
+        (*client)->m_is_open = false;
+        client = clients.erase(client);
+        continue;
+      }
+
+      auto &buffer = (*client)->m_buffer;
+      buffer.append(chunk, received);
+      for (auto newline = buffer.find('\n'); newline != std::string::npos;
+           newline = buffer.find('\n')) {
+        auto line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        if (!line.empty() && line.back() == '\r') {
+          line.pop_back();
+        }
+        if (line == "quit") {
+          should_quit = true;
+        } else if (line.find_first_not_of(" \t") != std::string::npos) {
+          pending.emplace_back(*client, std::move(line));
+        }
+      }
+      if (buffer.size() > max_line_length) {
+        std::cerr << "Dropping a client whose line exceeds "
+                  << max_line_length << " bytes" << std::endl;
+        (*client)->m_is_open = false;
+        client = clients.erase(client);
+        continue;
+      }
+      ++client;
+    }
+
+    if (descriptors[0].revents & POLLIN) {
+      try {
+        clients.push_back(
+            std::make_shared<Client>(Client{listener.accept(), {}, true}));
+      } catch (const std::runtime_error &error) {
+        std::cerr << error.what() << std::endl;
+      }
+    }
+
+    if (!pending.empty() && !should_quit) {
+      const auto [client, line] = std::move(pending.front());
+      pending.pop_front();
+      const auto reply = server.handle(line) + "\n";
+      if (client->m_is_open) {
+        try {
+          client->m_socket.send_all(reply.data(), reply.size());
+        } catch (const std::runtime_error &) {
+        }
+      }
+    }
+  }
+
+  if (address.rfind("unix:", 0) == 0) {
+    ::unlink(address.substr(5).c_str());
+  }
+  return true;
+}
+
+} // namespace
+
+bool run_server(const Options &options) {
+  RenderServer server(options);
+  if (options.m_serve_address == "-") {
+    return serve_standard_input(server);
+  }
+  return serve_socket(server, options.m_serve_address);
+}
@@ -0,0 +1,283 @@
+#include <socket.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+struct MessageHeader {
+  std::uint32_t m_type;
+  std::uint32_t m_payload_size;
+};
+
+[[noreturn]] void throw_system_error(const std::string &what) {
+  throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+bool starts_with(const std::string &value, const std::string &prefix) {
+  return value.compare(0, prefix.size(), prefix) == 0;
+}
+
+sockaddr_un unix_address(const std::string &path) {
+  sockaddr_un address{};
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("Socket path too long: " + path);
+  }
+  address.sun_family = AF_UNIX;
+  std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  return address;
+}
+
+// Splits "host:port", an empty host means any interface
+addrinfo *resolve_tcp(const std::string &host_and_port, const bool passive) {
+  const auto colon = host_and_port.rfind(':');
+  if (colon == std::string::npos) {
+    throw std::runtime_error("Expected host:port, got " + host_and_port);
+  }
+  const std::string host = host_and_port.substr(0, colon);
+  const std::string port = host_and_port.substr(colon + 1);
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+  addrinfo *result = nullptr;
+  const int status = getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                                 port.c_str(), &hints, &result);
+  if (status != 0) {
+    throw std::runtime_error("Could not resolve " + host_and_port + ": " +
+                             gai_strerror(status));
+  }
+  return result;
+}
+
+} // namespace
+
+Socket Socket::listen(const std::string &address) {
+  if (starts_with(address, "unix:")) {
+    const std::string path = address.substr(5);
+    Socket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!socket.is_open()) {
+      throw_system_error("socket");
+    }
+    // Clear out a socket file left behind by an earlier run
+    ::unlink(path.c_str());
+    const auto socket_address = unix_address(path);
+    if (::bind(socket.m_file_descriptor,
+               reinterpret_cast<const sockaddr *>(&socket_address),
+               sizeof(socket_address)) < 0) {
+      throw_system_error("bind " + path);
+    }
+    if (::listen(socket.m_file_descriptor, SOMAXCONN) < 0) {
+      throw_system_error("listen " + path);
+    }
+    return socket;
+  }
+
+  if (starts_with(address, "tcp:")) {
+    addrinfo *info = resolve_tcp(address.substr(4), true);
+    Socket socket(::socket(info->ai_family, info->ai_socktype, 0));
+    if (!socket.is_open()) {
+      freeaddrinfo(info);
+      throw_system_error("socket");
+    }
+    const int enable = 1;
+    ::setsockopt(socket.m_file_descriptor, SOL_SOCKET, SO_REUSEADDR, &enable,
+                 sizeof(enable));
+    const int status =
+        ::bind(socket.m_file_descriptor, info->ai_addr, info->ai_addrlen);
+    freeaddrinfo(info);
+    if (status < 0) {
+      throw_system_error("bind " + address);
+    }
+    if (::listen(socket.m_file_descriptor, SOMAXCONN) < 0) {
+      throw_system_error("listen " + address);
+    }
+    return socket;
+  }
+
+  throw std::runtime_error("Unsupported address: " + address);
+}
+
+Socket Socket::connect(const std::string &address) {
+  if (starts_with(address, "unix:")) {
+    Socket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!socket.is_open()) {
+      throw_system_error("socket");
+    }
+    const auto socket_address = unix_address(address.substr(5));
+    if (::connect(socket.m_file_descriptor,
+                  reinterpret_cast<const sockaddr *>(&socket_address),
+                  sizeof(socket_address)) < 0) {
+      throw_system_error("connect " + address);
+    }
+    return socket;
+  }
+
+  if (starts_with(address, "tcp:")) {
+    addrinfo *info = resolve_tcp(address.substr(4), false);
+    Socket socket(::socket(info->ai_family, info->ai_socktype, 0));
+    if (!socket.is_open()) {
+      freeaddrinfo(info);
+      throw_system_error("socket");
+    }
+    const int status =
+        ::connect(socket.m_file_descriptor, info->ai_addr, info->ai_addrlen);
+    freeaddrinfo(info);
+    if (status < 0) {
+      throw_system_error("connect " + address);
+    }
+    // Tile requests are tiny, don't let Nagle hold them back
+    const int enable = 1;
+    ::setsockopt(socket.m_file_descriptor, IPPROTO_TCP, TCP_NODELAY, &enable,
+                 sizeof(enable));
+    return socket;
+  }
+
+  throw std::runtime_error("Unsupported address: " + address);
+}
+
+Socket Socket::accept() const {
+  const int file_descriptor = ::accept(m_file_descriptor, nullptr, nullptr);
+  if (file_descriptor < 0) {
+    throw_system_error("accept");
+  }
+  return Socket(file_descriptor);
+}
+
+void Socket::close() {
+  if (m_file_descriptor >= 0) {
+    ::close(m_file_descriptor);
+    m_file_descriptor = -1;
+  }
+}
+
+void Socket::send_all(const void *data, size_t size) const {
+  const char *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    // MSG_NOSIGNAL turns a dead peer into an error instead of SIGPIPE
+    const auto sent = ::send(m_file_descriptor, bytes, size, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw_system_error("send");
+    }
+    bytes += sent;
+    size -= size_t(sent);
+  }
+}
+
+bool Socket::receive_all(void *data, size_t size) const {
+  char *bytes = static_cast<char *>(data);
+  while (size > 0) {
+    const size_t received = receive_some(bytes, size);
+    if (received == 0) {
+      return false;
+    }
+    bytes += received;
+    size -= received;
+  }
+  return true;
+}
+
+size_t Socket::receive_some(void *data, size_t size) const {
+  for (;;) {
+    const auto received = ::recv(m_file_descriptor, data, size, 0);
+    if (received >= 0) {
+      return size_t(received);
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    // A reset connection is as good as a closed one
+    if (errno == ECONNRESET) {
+      return 0;
+    }
+    throw_system_error("recv");
+  }
+}
+
+void send_message(const Socket &socket, const MessageType type,
+                  const std::vector<char> &payload) {
+  const MessageHeader header{std::uint32_t(type),
+                             std::uint32_t(payload.size())};
+  socket.send_all(&header, sizeof(header));
+  socket.send_all(payload.data(), payload.size());
+}
+
+bool receive_message(const Socket &socket, Message &message) {
+  MessageHeader header;
+  if (!socket.receive_all(&header, sizeof(header))) {
+    return false;
+  }
+  message.m_type = MessageType(header.m_type);
+  message.m_payload.resize(header.m_payload_size);
+  return socket.receive_all(message.m_payload.data(), header.m_payload_size);
+}
+
+bool MessageReader::read_available(const Socket &socket) {
+  char chunk[1 << 16];
+  const size_t received = socket.receive_some(chunk, sizeof(chunk));
+  if (received == 0) {
+    return false;
+  }
+  m_buffer.insert(std::end(m_buffer), chunk, chunk + received);
+  return true;
+}
+
+bool MessageReader::next(Message &message) {
+  MessageHeader header;
+  if (m_buffer.size() < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, m_buffer.data(), sizeof(header));
+  const size_t message_size = sizeof(header) + header.m_payload_size;
+  if (m_buffer.size() < message_size) {
+    return false;
+  }
+  message.m_type = MessageType(header.m_type);
+  message.m_payload.assign(std::begin(m_buffer) + sizeof(header),
+                           std::begin(m_buffer) + message_size);
+  m_buffer.erase(std::begin(m_buffer), std::begin(m_buffer) + message_size);
+  return true;
+}
+
+void append_u32(std::vector<char> &payload, const std::uint32_t value) {
+  const char *bytes = reinterpret_cast<const char *>(&value);
+  payload.insert(std::end(payload), bytes, bytes + sizeof(value));
+}
+
+void append_string(std::vector<char> &payload, const std::string &value) {
+  append_u32(payload, std::uint32_t(value.size()));
+  payload.insert(std::end(payload), std::begin(value), std::end(value));
+}
+
+std::uint32_t read_u32(const std::vector<char> &payload, size_t &offset) {
+  std::uint32_t value;
+  if (offset + sizeof(value) > payload.size()) {
+    throw std::runtime_error("Truncated message");
+  }
+  std::memcpy(&value, payload.data() + offset, sizeof(value));
+  offset += sizeof(value);
+  return value;
+}
+
+std::string read_string(const std::vector<char> &payload, size_t &offset) {
+  const auto size = read_u32(payload, offset);
+  if (offset + size > payload.size()) {
+    throw std::runtime_error("Truncated message");
+  }
+  std::string value(payload.data() + offset, size);
+  offset += size;
+  return value;
+}